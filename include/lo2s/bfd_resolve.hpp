@@ -111,10 +111,22 @@ private:
     }
 };
 
+/*
+ * libbfd is not thread-safe, not even across handles: the cache of open files, the last error and
+ * the error handler are process-wide. Every call into BFD must therefore hold this mutex, which
+ * Lib does internally. Lookups can be issued from several threads, but they are serialized.
+ */
+inline std::mutex& bfd_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
 struct bfd_handle_deleter
 {
     void operator()(bfd* p) const
     {
+        std::lock_guard<std::mutex> lock(bfd_mutex());
         bfd_close(p);
     }
 };
@@ -133,7 +145,9 @@ using unique_char_ptr = std::unique_ptr<char, char_handle_deleter>;
 class Lib
 {
 public:
-    Lib(const std::string& name);
+    // Without function_names, the symbol table is not canonicalized, which is the most expensive
+    // part of opening a binary. Lookups then only take function names from the debug information.
+    Lib(const std::string& name, bool function_names = true);
     Lib(const Lib&) = delete;
     Lib(Lib&&) = delete;
     Lib& operator=(const Lib&) = delete;
@@ -158,6 +172,10 @@ private:
 
     void read_sections();
 
+    void read_code_sections();
+
+    void add_section(asection* section);
+
     template <typename T>
     static T check_symtab(T sz)
     {
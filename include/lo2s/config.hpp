@@ -64,20 +64,42 @@ struct Config
     std::string trace_path;
     // perf
     std::size_t mmap_pages;
+    bool adaptive_buffers;
+    bool consolidate_buffers;
+    std::size_t mmap_budget_pages;
+    std::size_t monitor_workers = 0;
+    bool inherit = false;
+    bool self_metrics = false;
+    bool flight_recorder = false;
+    std::chrono::nanoseconds flight_recorder_window;
     bool exclude_kernel;
     // Instruction sampling
     bool sampling;
     std::uint64_t sampling_period;
     std::string sampling_event;
     bool enable_cct;
+    bool dwarf_unwind = false;
+    std::size_t stack_dump_size = 0;
     bool suppress_ip;
     bool disassemble;
+    bool line_info = true;
+    bool defer_symbols = false;
+    std::string symbol_cache_dir;
+    std::size_t symbol_cache_size = 0;
+    std::chrono::milliseconds cctx_merge_interval = std::chrono::milliseconds(0);
+    std::chrono::milliseconds profile_window = std::chrono::milliseconds(0);
+    std::size_t reorder_window = 0;
     // Interval monitors
     std::chrono::nanoseconds read_interval;
     std::chrono::nanoseconds userspace_read_interval;
     std::chrono::nanoseconds perf_read_interval = std::chrono::nanoseconds(0);
     // Metrics
     bool metric_use_frequency;
+    bool metric_suppress_unchanged = false;
+    double metric_tolerance = 0;
+    std::size_t metric_heartbeat = 0;
+    bool cpuid_suppress_unchanged = false;
+    std::size_t cpuid_heartbeat = 0;
 
     std::uint64_t metric_count;
     std::uint64_t metric_frequency;
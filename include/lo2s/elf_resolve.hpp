@@ -0,0 +1,160 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <lo2s/address.hpp>
+
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lo2s
+{
+namespace elfr
+{
+
+class InitError : public std::runtime_error
+{
+public:
+    InitError(const std::string& what, const std::string& lib)
+    : std::runtime_error(what + ": " + lib)
+    {
+    }
+};
+
+class LookupError : public std::runtime_error
+{
+public:
+    LookupError(const std::string& what, Address addr) : std::runtime_error(msg(what, addr))
+    {
+    }
+
+private:
+    static std::string msg(const std::string& what, Address addr)
+    {
+        std::stringstream ss;
+        ss << what << ": " << addr;
+        return ss.str();
+    }
+};
+
+/*
+ * Function symbol index built directly from the .symtab (or .dynsym) of an ELF file.
+ *
+ * Symbols are kept in an array sorted by file offset, so a lookup is a binary search. Names are
+ * demangled on first use and cached. This only resolves function names, source files and line
+ * numbers still require bfdr::Lib.
+ *
+ * The index is a self-contained image that can be stored in the SymbolCache and mmapped again
+ * by later runs instead of parsing the ELF file.
+ */
+class Lib
+{
+public:
+    struct Symbol
+    {
+        uint64_t start;
+        uint64_t end;
+        // offset of the null-terminated name in the string area of the image
+        uint64_t name;
+    };
+
+    struct ImageHeader
+    {
+        static constexpr uint64_t MAGIC = 0x6d79732d73326f6c; // "lo2s-sym"
+        static constexpr uint64_t VERSION = 1;
+
+        uint64_t magic;
+        uint64_t version;
+        uint64_t num_symbols;
+        uint64_t strings_size;
+        // followed by Symbol[num_symbols] and char[strings_size]
+    };
+
+    Lib(const std::string& name);
+    ~Lib();
+
+    Lib(const Lib&) = delete;
+    Lib(Lib&&) = delete;
+    Lib& operator=(const Lib&) = delete;
+    Lib& operator=(Lib&&) = delete;
+
+    // Hex string of the GNU build-id note, empty if the file has none or is not an ELF file
+    static std::string build_id(const std::string& filename);
+
+    // addr is an offset into the file, like for bfdr::Lib::lookup
+    const std::string& lookup(Address addr) const;
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+    std::size_t size() const
+    {
+        return num_symbols_;
+    }
+
+    // Sorted by start
+    const Symbol& symbol(std::size_t index) const
+    {
+        return symbols_[index];
+    }
+
+private:
+    void build_image(const char* elf, std::size_t size);
+
+    // Symbol names are offsets into the ELF file here
+    template <typename Ehdr, typename Shdr, typename Sym>
+    static std::vector<Symbol> read_symbols(const char* elf, std::size_t size);
+
+    template <typename Ehdr, typename Shdr>
+    static std::string read_build_id(const char* elf, std::size_t size);
+
+    bool map_image(const std::string& path);
+
+    // Points symbols_ and strings_ into the image, returns false if it is malformed
+    bool use_image(const char* image, std::size_t size);
+
+    std::string name_;
+
+    // The image is either built in memory or mapped from the cache
+    std::vector<char> built_image_;
+    void* mapped_image_ = nullptr;
+    std::size_t mapped_size_ = 0;
+
+    const Symbol* symbols_ = nullptr;
+    std::size_t num_symbols_ = 0;
+    const char* strings_ = nullptr;
+
+    mutable std::mutex demangled_mutex_;
+    mutable std::unordered_map<std::size_t, std::string> demangled_;
+};
+} // namespace elfr
+} // namespace lo2s
@@ -21,10 +21,23 @@
 
 #pragma once
 
-#include <filesystem>
+#include <lo2s/string_pool.hpp>
+
+#include <functional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+#include <cstdint>
 
 namespace lo2s
 {
+/*
+ * The strings of a LineInfo live in the global StringPool, so that it is cheap to copy, compare and
+ * hash, no matter how long the (demangled) function names get.
+ */
 struct LineInfo
 {
 private:
@@ -33,15 +46,18 @@ private:
     // Note: If line is not known, we write 1 anyway so the rest is shown in vampir
     // phijor 2018-11-08: I think this workaround is not needed anymore? vampir
     // shows source code locations with line == 0 just fine.
-    LineInfo(const std::string& file, const std::string& function, unsigned int line,
-             const std::string& dso)
-    : file(file), function(function), line((line != UNKNOWN_LINE) ? line : 1), dso(dso)
+    LineInfo(std::string_view file, std::string_view function, unsigned int line,
+             std::string_view dso)
+    : file_(StringPool::instance().intern(file)),
+      function_(StringPool::instance().intern(function)),
+      line_((line != UNKNOWN_LINE) ? line : 1), dso_(StringPool::instance().intern(dso))
     {
     }
 
-    LineInfo(const char* file, const char* function, unsigned int line, const std::string& dso)
-    : file(file), function(function), line((line != UNKNOWN_LINE) ? line : 1), dso(dso)
+    static std::string_view filename(std::string_view path)
     {
+        auto pos = path.rfind('/');
+        return (pos == std::string_view::npos) ? path : path.substr(pos + 1);
     }
 
 public:
@@ -50,18 +66,27 @@ public:
     {
         return LineInfo((file != nullptr) ? file : "<unknown file>",
                         (function != nullptr) ? function : "<unknown function>", line,
-                        std::filesystem::path(dso).filename().string());
+                        filename(dso));
     }
 
     static LineInfo for_unknown_function()
     {
-        return LineInfo("<unknown file>", "<unknown function>", UNKNOWN_LINE, "<unknown binary>");
+        static const LineInfo unknown("<unknown file>", "<unknown function>", UNKNOWN_LINE,
+                                      "<unknown binary>");
+        return unknown;
     }
 
     static LineInfo for_unknown_function_in_dso(const std::string& dso)
     {
-        return LineInfo("<unknown file>", "<unknown function>", UNKNOWN_LINE,
-                        std::filesystem::path(dso).filename().string());
+        return LineInfo("<unknown file>", "<unknown function>", UNKNOWN_LINE, filename(dso));
+    }
+
+    // Placeholder for an instruction that is only resolved by lo2s-symbolize (--defer-symbols)
+    static LineInfo for_offset_in_dso(const std::string& dso, uint64_t offset)
+    {
+        std::stringstream function;
+        function << filename(dso) << "+0x" << std::hex << offset;
+        return LineInfo(dso, function.str(), UNKNOWN_LINE, filename(dso));
     }
 
     static LineInfo for_binary(const std::string& binary)
@@ -69,27 +94,65 @@ public:
         return LineInfo(binary, binary, UNKNOWN_LINE, binary);
     }
 
-    std::string file;
-    std::string function;
-    unsigned int line;
-    std::string dso;
+    const std::string& file() const
+    {
+        return StringPool::instance().str(file_);
+    }
 
-    // For std::map
+    const std::string& function() const
+    {
+        return StringPool::instance().str(function_);
+    }
+
+    unsigned int line() const
+    {
+        return line_;
+    }
+
+    const std::string& dso() const
+    {
+        return StringPool::instance().str(dso_);
+    }
+
+    // Only meaningful within one process, as ids are handed out in interning order
     bool operator<(const LineInfo& other) const
     {
-        return std::tie(file, function, line, dso) <
-               std::tie(other.file, other.function, other.line, dso);
+        return std::tie(file_, function_, line_, dso_) <
+               std::tie(other.file_, other.function_, other.line_, other.dso_);
     }
     bool operator==(const LineInfo& other) const
     {
-        return std::tie(file, function, line, dso) ==
-               std::tie(other.file, other.function, other.line, dso);
+        return std::tie(file_, function_, line_, dso_) ==
+               std::tie(other.file_, other.function_, other.line_, other.dso_);
     }
+
+private:
+    friend struct std::hash<LineInfo>;
+
+    StringPool::Id file_;
+    StringPool::Id function_;
+    unsigned int line_;
+    StringPool::Id dso_;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const LineInfo& info)
 {
-    return os << info.function << " @ " << info.file << ":" << info.line << " in " << info.dso;
+    return os << info.function() << " @ " << info.file() << ":" << info.line() << " in "
+              << info.dso();
 }
 
 } // namespace lo2s
+
+namespace std
+{
+template <>
+struct hash<lo2s::LineInfo>
+{
+    std::size_t operator()(const lo2s::LineInfo& info) const
+    {
+        uint64_t h = (uint64_t(info.file_) << 32) ^ info.function_;
+        h = h * 0x9e3779b97f4a7c15 ^ ((uint64_t(info.dso_) << 32) | info.line_);
+        return std::hash<uint64_t>()(h * 0x9e3779b97f4a7c15);
+    }
+};
+} // namespace std
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <lo2s/build_config.hpp>
 #include <lo2s/time/time.hpp>
 
 #include <nitro/log/log.hpp>
@@ -69,9 +70,37 @@ using Lo2sFilter = nitro::log::filter::severity_filter<R>;
 using Logging =
     nitro::log::logger<Record, Lo2sLogFormatter, nitro::log::sink::StdErrThreaded, Lo2sFilter>;
 
+inline int verbosity(nitro::log::severity_level sev)
+{
+    switch (sev)
+    {
+    case nitro::log::severity_level::fatal:
+        return 0;
+    case nitro::log::severity_level::error:
+        return 1;
+    case nitro::log::severity_level::warn:
+        return 2;
+    case nitro::log::severity_level::info:
+        return 3;
+    case nitro::log::severity_level::debug:
+        return 4;
+    default:
+        return 5;
+    }
+}
+
+// Mirrors the severity filter, so that LO2S_HOT_LOG can check it without creating a record
+inline int min_verbosity = verbosity(nitro::log::severity_level::info);
+
+inline bool enabled(nitro::log::severity_level sev)
+{
+    return verbosity(sev) <= min_verbosity;
+}
+
 inline void set_min_severity_level(nitro::log::severity_level sev)
 {
     Lo2sFilter<Record>::set_severity(sev);
+    min_verbosity = verbosity(sev);
 }
 
 inline nitro::log::severity_level get_min_severity_level()
@@ -89,3 +118,25 @@ inline void set_min_severity_level(std::string verbosity)
 
 using Log = logging::Logging;
 } // namespace lo2s
+
+// Logging for hot paths, e.g. code that runs for every perf record:
+//
+//     LO2S_HOT_LOG(trace) << "head: " << head;
+//
+// Unlike Log::trace(), nothing is formatted unless the severity is enabled. Without
+// USE_HOT_PATH_LOGGING, the statement is compiled out completely.
+#ifdef USE_HOT_PATH_LOGGING
+#define LO2S_HOT_LOG(severity)                                                                     \
+    if (!lo2s::logging::enabled(nitro::log::severity_level::severity))                             \
+    {                                                                                              \
+    }                                                                                              \
+    else                                                                                           \
+        lo2s::Log::severity()
+#else
+#define LO2S_HOT_LOG(severity)                                                                     \
+    if (true)                                                                                      \
+    {                                                                                              \
+    }                                                                                              \
+    else                                                                                           \
+        lo2s::Log::severity()
+#endif
@@ -0,0 +1,109 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <lo2s/config.hpp>
+
+#include <vector>
+
+#include <cmath>
+#include <cstddef>
+
+namespace lo2s
+{
+namespace metric
+{
+
+/*
+ * Decides whether a metric event for one metric instance has to be written at all.
+ *
+ * If enabled, an event is only written if any of its values differs by more than the tolerance
+ * from the last written event, or as a heartbeat if the last `heartbeat` events have been
+ * suppressed. Otherwise, every event is written.
+ *
+ * The settings are chosen per recorder. Without them, those of the interval based metrics
+ * (--metric-suppress-unchanged and friends) are used.
+ */
+class ChangeFilter
+{
+public:
+    ChangeFilter(std::size_t num_values)
+    : ChangeFilter(num_values, config().metric_suppress_unchanged, config().metric_tolerance,
+                   config().metric_heartbeat)
+    {
+    }
+
+    ChangeFilter(std::size_t num_values, bool enabled, double tolerance, std::size_t heartbeat)
+    : enabled_(enabled), tolerance_(tolerance), heartbeat_(heartbeat), current_(num_values),
+      last_(num_values)
+    {
+    }
+
+    void value(std::size_t index, double value)
+    {
+        current_[index] = value;
+    }
+
+    // Call once per event after setting all values
+    bool should_write()
+    {
+        if (!enabled_ || first_)
+        {
+            return accept();
+        }
+
+        for (std::size_t i = 0; i < current_.size(); i++)
+        {
+            // also catches NaN changes, for which the difference is never above the tolerance
+            if (!(std::abs(current_[i] - last_[i]) <= tolerance_))
+            {
+                return accept();
+            }
+        }
+
+        if (heartbeat_ != 0 && ++suppressed_ >= heartbeat_)
+        {
+            return accept();
+        }
+        return false;
+    }
+
+private:
+    bool accept()
+    {
+        last_ = current_;
+        suppressed_ = 0;
+        first_ = false;
+        return true;
+    }
+
+    bool enabled_;
+    double tolerance_;
+    std::size_t heartbeat_;
+
+    std::vector<double> current_;
+    std::vector<double> last_;
+    std::size_t suppressed_ = 0;
+    bool first_ = true;
+};
+} // namespace metric
+} // namespace lo2s
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <lo2s/metric/change_filter.hpp>
 #include <lo2s/monitor/poll_monitor.hpp>
 #include <lo2s/time/time.hpp>
 #include <lo2s/trace/fwd.hpp>
@@ -62,6 +63,10 @@ private:
     otf2::definition::metric_instance metric_instance_;
     std::unique_ptr<otf2::event::metric> event_;
 
+    // All metric members but the last one, the NVML monitoring time
+    static constexpr std::size_t NUM_FILTERED_VALUES = 14;
+    ChangeFilter filter_;
+
     nvmlReturn_t result;
     nvmlDevice_t device;
     
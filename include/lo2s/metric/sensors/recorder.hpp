@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <lo2s/metric/change_filter.hpp>
 #include <lo2s/monitor/poll_monitor.hpp>
 #include <lo2s/time/time.hpp>
 #include <lo2s/trace/fwd.hpp>
@@ -28,6 +29,8 @@
 #include <otf2xx/definition/metric_instance.hpp>
 #include <otf2xx/writer/local.hpp>
 
+#include <optional>
+
 namespace lo2s
 {
 namespace metric
@@ -55,6 +58,8 @@ private:
     std::unique_ptr<otf2::event::metric> event_;
 
     std::vector<std::pair<const void*, int>> items_;
+    // constructed once all items are known
+    std::optional<ChangeFilter> filter_;
 };
 } // namespace sensors
 } // namespace metric
@@ -6,6 +6,7 @@
 
 #include <lo2s/time/time.hpp>
 
+#include <lo2s/metric/change_filter.hpp>
 #include <lo2s/monitor/poll_monitor.hpp>
 #include <lo2s/trace/fwd.hpp>
 
@@ -56,6 +57,7 @@ private:
 
     otf2::definition::metric_instance metric_instance_;
     otf2::event::metric event_;
+    ChangeFilter filter_;
 };
 } // namespace x86_adapt
 } // namespace metric
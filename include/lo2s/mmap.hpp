@@ -23,6 +23,7 @@
 
 #include <lo2s/address.hpp>
 #include <lo2s/bfd_resolve.hpp>
+#include <lo2s/elf_resolve.hpp>
 #ifdef HAVE_RADARE
 #include <lo2s/radare.hpp>
 #endif
@@ -31,9 +32,11 @@
 
 #include <deque>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <utility>
 
 extern "C"
 {
@@ -94,16 +97,15 @@ public:
 
 /**
  * TODO Split this... it's ugly
+ *
+ * Only the name is recorded when the binary is first mapped. The symbol tables (and the radare
+ * resolver) are loaded on the first lookup, so DSOs that never receive a sample cost nothing.
+ * Function names come from the ELF symbol index; BFD is only loaded for line information.
  */
 class BfdRadareBinary : public Binary
 {
 public:
-    BfdRadareBinary(const std::string& name)
-    : Binary(name), bfd_(name)
-#ifdef HAVE_RADARE
-      ,
-      radare_(name)
-#endif
+    BfdRadareBinary(const std::string& name) : Binary(name)
     {
     }
 
@@ -113,28 +115,22 @@ public:
     }
 
 #ifdef HAVE_RADARE
-    virtual std::string lookup_instruction(Address ip) override
-    {
-        return radare_.instruction(ip);
-    }
+    virtual std::string lookup_instruction(Address ip) override;
 #endif
 
-    virtual LineInfo lookup_line_info(Address ip) override
-    {
-        try
-        {
-            return bfd_.lookup(ip);
-        }
-        catch (bfdr::LookupError&)
-        {
-            return LineInfo::for_unknown_function_in_dso(name());
-        }
-    }
+    virtual LineInfo lookup_line_info(Address ip) override;
 
 private:
-    bfdr::Lib bfd_;
+    const elfr::Lib* elf();
+    const bfdr::Lib* bfd();
+
+    std::once_flag elf_once_;
+    std::unique_ptr<elfr::Lib> elf_;
+    std::once_flag bfd_once_;
+    std::unique_ptr<bfdr::Lib> bfd_;
 #ifdef HAVE_RADARE
-    RadareResolver radare_;
+    std::once_flag radare_once_;
+    std::unique_ptr<RadareResolver> radare_;
 #endif // HAVE_RADARE
 };
 
@@ -193,6 +189,20 @@ public:
     // Will throw alot - catch it if you can
     std::string lookup_instruction(Address ip) const;
 
+    // Returns the binary mapped at ip and the address of ip within that binary. Throws
+    // std::out_of_range if nothing is mapped at ip.
+    std::pair<Binary*, Address> lookup_binary(Address ip) const;
+
+    // Calls f(start, end, pgoff, binary) for every mapping in address order
+    template <typename F>
+    void for_each_mapping(F&& f) const
+    {
+        for (const auto& [range, mapping] : map_)
+        {
+            f(mapping.start, mapping.end, mapping.pgoff, mapping.dso);
+        }
+    }
+
 private:
     struct Mapping
     {
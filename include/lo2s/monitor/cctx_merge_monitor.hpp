@@ -0,0 +1,55 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <lo2s/monitor/poll_monitor.hpp>
+
+#include <string>
+
+namespace lo2s
+{
+namespace monitor
+{
+class MainMonitor;
+
+/*
+ * Periodically merges the calling contexts that the sample writers hand off with --merge-interval
+ * into the trace, so that only the last delta is left for the end of the measurement.
+ */
+class CctxMergeMonitor : public PollMonitor
+{
+public:
+    CctxMergeMonitor(MainMonitor& main_monitor);
+
+private:
+    void monitor(int fd) override;
+
+    std::string group() const override
+    {
+        return "lo2s::CctxMergeMonitor";
+    }
+
+    MainMonitor& main_monitor_;
+};
+} // namespace monitor
+} // namespace lo2s
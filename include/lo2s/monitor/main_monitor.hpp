@@ -37,12 +37,14 @@
 #endif
 #include <lo2s/mmap.hpp>
 #include <lo2s/monitor/bio_monitor.hpp>
+#include <lo2s/monitor/cctx_merge_monitor.hpp>
 #include <lo2s/monitor/tracepoint_monitor.hpp>
 #include <lo2s/process_info.hpp>
 #include <lo2s/trace/trace.hpp>
 #include <lo2s/types.hpp>
 
 #include <memory>
+#include <mutex>
 #include <vector>
 
 namespace lo2s
@@ -69,13 +71,22 @@ public:
         return process_infos_;
     }
 
+    // Current memory map snapshots of all processes, only holds process_infos_mutex_ briefly
+    ProcessMaps process_maps();
+
+    // Merges the calling contexts that the sample writers have handed off so far
+    void merge_pending_calling_contexts();
+
 protected:
     trace::Trace trace_;
     std::map<Process, ProcessInfo> process_infos_;
+    // Only needed for modifications of process_infos_ while the CctxMergeMonitor is running
+    std::mutex process_infos_mutex_;
     metric::plugin::Metrics metrics_;
     std::vector<std::unique_ptr<TracepointMonitor>> tracepoint_monitors_;
 
     std::unique_ptr<BioMonitor> bio_monitor_;
+    std::unique_ptr<CctxMergeMonitor> cctx_merge_monitor_;
 #ifdef HAVE_X86_ADAPT
     std::unique_ptr<metric::x86_adapt::Metrics> x86_adapt_metrics_;
 #endif
@@ -24,15 +24,20 @@
 #include <lo2s/error.hpp>
 #include <lo2s/log.hpp>
 #include <lo2s/monitor/threaded_monitor.hpp>
+#include <lo2s/perf/read_stats.hpp>
 #include <lo2s/pipe.hpp>
+#include <lo2s/self_metrics.hpp>
 #include <lo2s/trace/fwd.hpp>
 
 #include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
 #include <vector>
 
 extern "C"
 {
-#include <poll.h>
+#include <sys/epoll.h>
 }
 
 namespace lo2s
@@ -45,6 +50,7 @@ public:
     PollMonitor(trace::Trace& trace, const std::string& name,
                 std::chrono::nanoseconds read_interval);
 
+    void start() override;
     void stop() override;
 
     ~PollMonitor();
@@ -53,24 +59,61 @@ protected:
     void run() override;
     void monitor() override;
 
+    // Call handler whenever fd becomes readable
+    void add_fd(int fd, std::function<void()> handler);
+
+    // Without a dedicated handler, fd is passed on to monitor(int)
     void add_fd(int fd);
 
+    // Must only be called from within the monitoring thread or before it is started. Removing an
+    // fd that is not registered is a no-op.
+    void remove_fd(int fd);
+
     virtual void monitor([[maybe_unused]] int fd){};
 
-    struct pollfd& stop_pfd()
+    // Called for fds that report anything but EPOLLIN, e.g. EPOLLHUP once a monitored thread has
+    // exited. Return false to stop polling altogether.
+    virtual bool unexpected_event(int fd, uint32_t events);
+
+    int stop_fd() const
     {
-        return pfds_[0];
+        return stop_pipe_.read_fd();
     }
 
-    struct pollfd& timer_pfd()
+    int timer_fd() const
     {
-        return pfds_[1];
+        return timer_fd_;
     }
 
+    // With --self-metrics, returns a callback for EventReader::on_read() that records every
+    // read() of the reader and adds it to the wakeup statistics of this monitor. Otherwise, returns
+    // an empty function.
+    std::function<void(const perf::ReadStats&)> self_metrics(const std::string& reader_name);
+
     Pipe stop_pipe_;
 
 private:
-    std::vector<pollfd> pfds_;
+    struct Handler
+    {
+        int fd;
+        std::function<void()> callback;
+    };
+
+    // epoll_event.data.ptr points to the elements, so they must never move. Removed handlers are
+    // only erased after the current batch of ready events has been dispatched.
+    std::list<Handler> handlers_;
+    bool handlers_removed_ = false;
+    std::vector<epoll_event> ready_events_;
+    int num_ready_ = 0;
+
+    int epoll_fd_ = -1;
+    int timer_fd_ = -1;
+    bool stop_requested_ = false;
+
+    std::unique_ptr<SelfMetrics> self_metrics_;
+    // Elements are referenced by the callbacks of the readers, so they must never move
+    std::list<SelfMetrics> reader_metrics_;
+    perf::ReadStats wakeup_stats_;
 };
 } // namespace monitor
 } // namespace lo2s
@@ -23,10 +23,13 @@
 #include <lo2s/monitor/abstract_process_monitor.hpp>
 #include <lo2s/monitor/main_monitor.hpp>
 #include <lo2s/monitor/scope_monitor.hpp>
+#include <lo2s/monitor/scope_worker.hpp>
 #include <lo2s/process_info.hpp>
 
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 extern "C"
 {
@@ -53,6 +56,13 @@ public:
 
 private:
     std::map<Thread, ScopeMonitor> threads_;
+
+    // With --inherit, the whole process is monitored with inherited events on every CPU instead
+    std::map<Cpu, ScopeMonitor> cpus_;
+
+    // With --monitor-workers, threads are distributed over a fixed set of workers instead
+    std::vector<std::unique_ptr<ScopeWorker>> workers_;
+    std::map<Thread, ScopeWorker*> worker_threads_;
 };
 } // namespace monitor
 } // namespace lo2s
@@ -32,6 +32,7 @@
 
 #include <array>
 #include <chrono>
+#include <functional>
 #include <thread>
 
 #include <cstddef>
@@ -50,7 +51,9 @@ namespace monitor
 class ScopeMonitor : public PollMonitor
 {
 public:
-    ScopeMonitor(ExecutionScope scope, MainMonitor& parent, bool enable_on_exec);
+    // With a valid inherit_from, the CPU scope only samples that process, see --inherit
+    ScopeMonitor(ExecutionScope scope, MainMonitor& parent, bool enable_on_exec,
+                 Process inherit_from = Process::invalid());
 
     void initialize_thread() override;
     void finalize_thread() override;
@@ -69,10 +72,16 @@ public:
     }
 
 private:
+    void add_perf_fd(int fd, std::function<void()> handler);
+    void follow_scope();
+
     ExecutionScope scope_;
+    // With --consolidate-buffers, sample_writer_ dispatches the records of the syscall and group
+    // counter writers, which therefore have to stay in place while it exists. Members are
+    // destroyed in reverse order, so they must be declared before it.
     std::unique_ptr<perf::syscall::Writer> syscall_writer_;
-    std::unique_ptr<perf::sample::Writer> sample_writer_;
     std::unique_ptr<perf::counter::group::Writer> group_counter_writer_;
+    std::unique_ptr<perf::sample::Writer> sample_writer_;
     std::unique_ptr<perf::counter::userspace::Writer> userspace_counter_writer_;
 };
 } // namespace monitor
@@ -0,0 +1,100 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <lo2s/monitor/main_monitor.hpp>
+#include <lo2s/monitor/poll_monitor.hpp>
+
+#include <lo2s/perf/counter/group/writer.hpp>
+#include <lo2s/perf/counter/userspace/writer.hpp>
+#include <lo2s/perf/sample/writer.hpp>
+
+#include <lo2s/execution_scope.hpp>
+#include <lo2s/pipe.hpp>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace lo2s
+{
+namespace monitor
+{
+
+/*
+ * Reads the perf buffers of many threads in a single monitoring thread, instead of spawning a
+ * ScopeMonitor for each of them. Scopes are added and removed by the ProcessMonitor thread, the
+ * worker itself picks up these requests on its next wakeup.
+ */
+class ScopeWorker : public PollMonitor
+{
+public:
+    ScopeWorker(MainMonitor& parent, std::size_t id);
+
+    // Opens the perf events of the scope right away, so that nothing is missed before the worker
+    // gets to register them.
+    void insert_scope(ExecutionScope scope, bool enable_on_exec);
+    void remove_scope(ExecutionScope scope);
+
+    std::size_t num_scopes() const
+    {
+        return num_scopes_;
+    }
+
+    std::string group() const override
+    {
+        return "lo2s::ScopeWorker";
+    }
+
+private:
+    struct Writers
+    {
+        std::unique_ptr<perf::sample::Writer> sample_writer;
+        std::unique_ptr<perf::counter::group::Writer> group_counter_writer;
+        std::unique_ptr<perf::counter::userspace::Writer> userspace_counter_writer;
+
+        void read();
+    };
+
+    void monitor(int fd) override;
+    bool unexpected_event(int fd, uint32_t events) override;
+    void finalize_thread() override;
+
+    void handle_requests();
+    void register_scope(ExecutionScope scope, std::unique_ptr<Writers> writers);
+    void unregister_scope(ExecutionScope scope);
+
+    MainMonitor& parent_;
+
+    std::mutex requests_mutex_;
+    std::vector<std::pair<ExecutionScope, std::unique_ptr<Writers>>> pending_inserts_;
+    std::vector<ExecutionScope> pending_removals_;
+    Pipe requests_pipe_;
+
+    // Only accessed from the worker thread
+    std::map<ExecutionScope, std::unique_ptr<Writers>> scopes_;
+    std::atomic<std::size_t> num_scopes_ = 0;
+};
+} // namespace monitor
+} // namespace lo2s
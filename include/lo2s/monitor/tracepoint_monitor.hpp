@@ -51,6 +51,8 @@ private:
 
 private:
     Cpu cpu_;
+    // Held by pointer, as the writer owning the shared buffer of --consolidate-buffers keeps
+    // references to the others
     std::map<int, std::unique_ptr<perf::tracepoint::Writer>> perf_writers_;
 };
 } // namespace monitor
@@ -0,0 +1,66 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+
+namespace lo2s
+{
+
+/*
+ * Calls f(item) for every item on up to hardware_concurrency() threads, one of which is the
+ * calling thread. Items are handed out in order, so the most expensive ones should come first.
+ * Returns the number of threads used.
+ */
+template <class T, class F>
+std::size_t parallel_for_each(const std::vector<T>& items, F&& f)
+{
+    std::atomic<std::size_t> next = 0;
+    auto worker = [&items, &next, &f]() {
+        for (auto i = next++; i < items.size(); i = next++)
+        {
+            f(items[i]);
+        }
+    };
+
+    std::size_t num_workers =
+        std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), items.size());
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < num_workers; i++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+    return num_workers;
+}
+} // namespace lo2s
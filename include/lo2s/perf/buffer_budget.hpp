@@ -0,0 +1,83 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <lo2s/config.hpp>
+
+#include <atomic>
+#include <cstddef>
+
+namespace lo2s
+{
+namespace perf
+{
+
+/*
+ * Keeps track of the number of pages that adaptive perf ring buffers have grown beyond their
+ * initial --mmap-pages across all readers, so that this growth stays within --mmap-budget.
+ */
+class BufferBudget
+{
+private:
+    BufferBudget() : budget_pages_(config().mmap_budget_pages)
+    {
+    }
+
+public:
+    static BufferBudget& instance()
+    {
+        static BufferBudget b;
+        return b;
+    }
+
+    BufferBudget(const BufferBudget&) = delete;
+    BufferBudget& operator=(const BufferBudget&) = delete;
+
+    bool try_acquire(std::size_t pages)
+    {
+        auto used = used_pages_.load();
+        do
+        {
+            if (used + pages > budget_pages_)
+            {
+                return false;
+            }
+        } while (!used_pages_.compare_exchange_weak(used, used + pages));
+        return true;
+    }
+
+    void release(std::size_t pages)
+    {
+        used_pages_ -= pages;
+    }
+
+    std::size_t used_pages() const
+    {
+        return used_pages_;
+    }
+
+private:
+    const std::size_t budget_pages_;
+    std::atomic<std::size_t> used_pages_ = 0;
+};
+} // namespace perf
+} // namespace lo2s
@@ -0,0 +1,122 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <lo2s/trace/calling_context_trie.hpp>
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace lo2s
+{
+namespace perf
+{
+
+/*
+ * Direct-mapped cache from complete callchains to the leaf node in the calling context trie.
+ *
+ * Most samples share a few thousand distinct call paths, a hit saves the walk along the trie for
+ * every frame.
+ */
+class CallchainCache
+{
+public:
+    using NodeId = trace::CallingContextTrie::NodeId;
+
+    static constexpr std::size_t NUM_ENTRIES = 2048;
+
+    // Returns the cached leaf for the callchain below root, or INVALID_NODE on a miss. hash is set
+    // in any case, so that it can be passed to insert() on a miss.
+    NodeId lookup(NodeId root, uint64_t nr, const uint64_t ips[], uint64_t& hash)
+    {
+        if (entries_.empty())
+        {
+            entries_.resize(NUM_ENTRIES);
+        }
+
+        lookups_++;
+
+        hash = hash_callchain(root, nr, ips);
+        const auto& entry = entries_[hash % NUM_ENTRIES];
+        if (entry.leaf == trace::CallingContextTrie::INVALID_NODE || entry.hash != hash ||
+            entry.root != root || entry.ips.size() != nr ||
+            std::memcmp(entry.ips.data(), ips, nr * sizeof(uint64_t)) != 0)
+        {
+            return trace::CallingContextTrie::INVALID_NODE;
+        }
+
+        hits_++;
+        return entry.leaf;
+    }
+
+    void insert(uint64_t hash, NodeId root, uint64_t nr, const uint64_t ips[], NodeId leaf)
+    {
+        auto& entry = entries_[hash % NUM_ENTRIES];
+        entry.hash = hash;
+        entry.root = root;
+        entry.leaf = leaf;
+        // reuses the storage of the evicted entry
+        entry.ips.assign(ips, ips + nr);
+    }
+
+    std::size_t hits() const
+    {
+        return hits_;
+    }
+
+    std::size_t lookups() const
+    {
+        return lookups_;
+    }
+
+private:
+    static uint64_t hash_callchain(NodeId root, uint64_t nr, const uint64_t ips[])
+    {
+        constexpr uint64_t k = 0x9e3779b97f4a7c15ull;
+
+        uint64_t hash = (root + nr) * k;
+        for (uint64_t i = 0; i < nr; i++)
+        {
+            hash = (hash ^ ips[i]) * k;
+            hash ^= hash >> 29;
+        }
+        return hash;
+    }
+
+    struct Entry
+    {
+        uint64_t hash = 0;
+        NodeId root = trace::CallingContextTrie::INVALID_NODE;
+        NodeId leaf = trace::CallingContextTrie::INVALID_NODE;
+        std::vector<uint64_t> ips;
+    };
+
+    std::vector<Entry> entries_;
+    std::size_t hits_ = 0;
+    std::size_t lookups_ = 0;
+};
+} // namespace perf
+} // namespace lo2s
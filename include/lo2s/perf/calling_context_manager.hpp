@@ -21,10 +21,22 @@
 #pragma once
 
 #include <lo2s/config.hpp>
+#include <lo2s/perf/callchain_cache.hpp>
+#include <lo2s/perf/sample/user_stack.hpp>
+#include <lo2s/summary.hpp>
 #include <lo2s/trace/trace.hpp>
 
 #include <otf2xx/otf2.hpp>
 
+#include <mutex>
+#include <optional>
+#include <utility>
+
+extern "C"
+{
+#include <linux/perf_event.h>
+}
+
 namespace lo2s
 {
 namespace perf
@@ -33,31 +45,84 @@ namespace perf
 class CallingContextManager
 {
 public:
-    CallingContextManager(trace::Trace& trace) : local_cctx_refs_(trace.create_cctx_refs())
+    // For the unwind distance definition, see:
+    // http://scorepci.pages.jsc.fz-juelich.de/otf2-pipelines/docs/otf2-2.2/html/group__records__definition.
+    // html#CallingContext
+    //
+    // Every sample has the fake calling context of the scheduled process as its root, so the
+    // unwind distance is the number of actual frames plus one.
+    struct SampleRef
+    {
+        otf2::definition::calling_context::reference_type ref;
+        uint64_t unwind_distance;
+    };
+
+    CallingContextManager(trace::Trace& trace)
+    : local_cctx_refs_(trace.create_cctx_refs()), trie_(local_cctx_refs_.trie),
+      kernel_stacks_(trace.kernel_stacks())
     {
     }
 
     void thread_enter(Process process, Thread thread)
     {
-        auto ret =
-            local_cctx_refs_.map.emplace(std::piecewise_construct, std::forward_as_tuple(thread),
-                                         std::forward_as_tuple(process, next_cctx_ref_));
-        if (ret.second)
+        auto it = local_cctx_refs_.map.find(thread);
+        if (it == local_cctx_refs_.map.end())
         {
-            next_cctx_ref_++;
+            it = local_cctx_refs_.map
+                     .emplace(std::piecewise_construct, std::forward_as_tuple(thread),
+                              std::forward_as_tuple(process, trie_.add_root()))
+                     .first;
         }
 
-        current_thread_cctx_refs_ = &(*ret.first);
+        current_thread_cctx_refs_ = &(*it);
     }
 
     void finalize(otf2::writer::local* otf2_writer)
     {
-        local_cctx_refs_.ref_count = next_cctx_ref_;
+        local_cctx_refs_.ref_count = trie_.size();
+        summary().record_callchain_cache(callchain_cache_.hits(), callchain_cache_.lookups());
         // set writer last, because it is used as sentry to confirm that the cctx refs are properly
         // finalized.
         local_cctx_refs_.writer = otf2_writer;
     }
 
+    // Hands off the calling context tree recorded so far for merging by the trace, and continues
+    // with a fresh tree. The current thread, if any, is entered again with a new local reference.
+    void flush()
+    {
+        if (trie_.size() == 0)
+        {
+            return;
+        }
+
+        std::optional<std::pair<Process, Thread>> current;
+        if (current_thread_cctx_refs_)
+        {
+            current.emplace(current_thread_cctx_refs_->second.process,
+                            current_thread_cctx_refs_->first);
+            current_thread_cctx_refs_ = nullptr;
+        }
+
+        trace::CallingContextTrie next(trie_.next_id());
+        trace::CctxDelta delta{ std::move(local_cctx_refs_.map), std::move(trie_) };
+        if (local_cctx_refs_.spill)
+        {
+            delta.spill_end = local_cctx_refs_.spill->flush();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(local_cctx_refs_.pending_mutex);
+            local_cctx_refs_.pending.push_back(std::move(delta));
+        }
+        local_cctx_refs_.map.clear();
+        trie_ = std::move(next);
+
+        if (current)
+        {
+            thread_enter(current->first, current->second);
+        }
+    }
+
     bool thread_changed(Thread thread)
     {
         return !current_thread_cctx_refs_ || current_thread_cctx_refs_->first != thread;
@@ -67,53 +132,77 @@ public:
     {
         if (current_thread_cctx_refs_)
         {
-            return current_thread_cctx_refs_->second.entry.ref;
+            return current_thread_cctx_refs_->second.root;
         }
         else
         {
             return otf2::definition::calling_context::reference_type::undefined();
         }
     }
-    otf2::definition::calling_context::reference_type sample_ref(uint64_t num_ips,
-                                                                 const uint64_t ips[])
+    SampleRef sample_ref(uint64_t num_ips, const uint64_t ips[])
     {
-        // For unwind distance definiton, see:
-        // http://scorepci.pages.jsc.fz-juelich.de/otf2-pipelines/docs/otf2-2.2/html/group__records__definition.
-        // html#CallingContext
-
-        // We always have a fake CallingContext for the process, which is scheduled.
-        // So if we don't record the calling context tree, all nodes in the calling context tree
-        // are: The fake node for the process and a second node for the current context of the
-        // sample. Therefore, we always have an unwind distance of 2. (Technically, it could also be
-        // 1, but we lack the information to distinguish those cases. Hence, we stick with 2.)
-        //
-        // However, in the case that we actually record the complete call stack, we get the number
-        // of nodes in the calling context tree from the number of elements in the call stack
-        // recorded from perf. Tough, we still have the fake calling context for the process, which
-        // adds 1 to that number. But we also remove the lowest entry from the call stack, because
-        // that is ALWAYS in the kernel, which can't be resolved and thus doesn't provide any useful
-        // information.
-        //
-        // Having these things in mind, look at this line and tell me, why it is still wrong:
-        auto children = &current_thread_cctx_refs_->second.entry.children;
-        for (uint64_t i = num_ips - 1;; i--)
-        {
-            auto it = find_ip_child(ips[i], *children);
-            // We intentionally discard the last sample as it is somewhere in the kernel
-            if (i == 1)
+        // The PERF_CONTEXT_* markers are not frames. The kernel frames are a single node in the
+        // trie, but they are expanded to one calling context per frame when merging.
+        uint64_t frames = 1;
+        for (uint64_t i = 0; i < num_ips; i++)
+        {
+            if (!is_context_marker(ips[i]))
             {
-                return it->second.ref;
+                frames++;
             }
+        }
 
-            children = &it->second.children;
+        auto root = current_thread_cctx_refs_->second.root;
+        uint64_t hash;
+        auto node = callchain_cache_.lookup(root, num_ips, ips, hash);
+        if (node != trace::CallingContextTrie::INVALID_NODE)
+        {
+            return { node, frames };
         }
+
+        auto kernel_end = kernel_frames_end(num_ips, ips);
+
+        node = root;
+        for (uint64_t i = num_ips; i-- > kernel_end;)
+        {
+            if (!is_context_marker(ips[i]))
+            {
+                node = find_ip_child(ips[i], node);
+            }
+        }
+        node = insert_kernel_frames(node, kernel_end, ips);
+
+        callchain_cache_.insert(hash, root, num_ips, ips, node);
+        return { node, frames };
     }
 
-    otf2::definition::calling_context::reference_type sample_ref(uint64_t ip)
+    // With --call-graph-dwarf, the user stack is spilled for unwinding after recording. Until
+    // then, the user part of the calling context is a placeholder node for the spilled stack.
+    SampleRef sample_ref(uint64_t num_ips, const uint64_t ips[],
+                         const sample::UserStack& user_stack)
     {
-        auto it = find_ip_child(ip, current_thread_cctx_refs_->second.entry.children);
+        // The user frames only exist once the spilled stack is unwound while merging, which is
+        // long after the sample has been written. So the unwind distance can only count the
+        // process root and the kernel frames, which is a lower bound of the final depth.
+        auto kernel_end = kernel_frames_end(num_ips, ips);
+        uint64_t frames = 1 + (kernel_end > 1 ? kernel_end - 1 : 0);
+
+        auto node = current_thread_cctx_refs_->second.root;
+        if (user_stack.regs != nullptr)
+        {
+            auto id = local_cctx_refs_.spill->append(current_thread_cctx_refs_->second.process,
+                                                     user_stack.regs, sample::NUM_USER_REGS,
+                                                     user_stack.data, user_stack.size);
+            node = trie_.find_or_insert_child(node, trace::StackSpill::tag(id));
+        }
+        return { insert_kernel_frames(node, kernel_end, ips), frames };
+    }
 
-        return it->second.ref;
+    // Without the call stack, there is only the sampled instruction below the process. (The
+    // distance could also be 1, but we lack the information to distinguish those cases.)
+    SampleRef sample_ref(uint64_t ip)
+    {
+        return { find_ip_child(ip, current_thread_cctx_refs_->second.root), 2 };
     }
 
     void thread_leave(Thread thread)
@@ -121,33 +210,65 @@ public:
         assert(current_thread_cctx_refs_);
         if (current_thread_cctx_refs_->first != thread)
         {
-            Log::debug() << "inconsistent leave thread"; // will probably set to trace sooner or
-                                                         // later
+            // will probably set to trace sooner or later
+            LO2S_HOT_LOG(debug) << "inconsistent leave thread";
         }
         current_thread_cctx_refs_ = nullptr;
     }
 
 private:
-    trace::IpRefMap::iterator find_ip_child(Address addr, trace::IpRefMap& children)
+    static bool is_context_marker(uint64_t ip)
+    {
+        return ip >= static_cast<uint64_t>(PERF_CONTEXT_MAX);
+    }
+
+    // perf puts the frames of each context after a marker, innermost first:
+    // [PERF_CONTEXT_KERNEL, kernel frames..., PERF_CONTEXT_USER, user frames...]
+    static uint64_t kernel_frames_end(uint64_t num_ips, const uint64_t ips[])
+    {
+        uint64_t kernel_end = 0;
+        if (num_ips > 0 && ips[0] == PERF_CONTEXT_KERNEL)
+        {
+            kernel_end = 1;
+            while (kernel_end < num_ips && !is_context_marker(ips[kernel_end]))
+            {
+                kernel_end++;
+            }
+        }
+        return kernel_end;
+    }
+
+    // The kernel frames are the same for all writers, so they are only referenced by the id of
+    // the interned stack.
+    trace::CallingContextTrie::NodeId insert_kernel_frames(trace::CallingContextTrie::NodeId node,
+                                                           uint64_t kernel_end,
+                                                           const uint64_t ips[])
+    {
+        if (kernel_end > 1)
+        {
+            auto id = kernel_stacks_.intern(ips + 1, kernel_end - 1);
+            node = trie_.find_or_insert_child(node, trace::KernelStackTable::tag(id));
+        }
+        return node;
+    }
+
+    trace::CallingContextTrie::NodeId find_ip_child(Address addr,
+                                                    trace::CallingContextTrie::NodeId parent)
     {
         // -1 can't be inserted into the ip map, as it imples a 1-byte region from -1 to 0.
         if (addr == -1)
         {
-            Log::debug() << "Got invalid ip (-1) from call stack. Replacing with -2.";
+            LO2S_HOT_LOG(debug) << "Got invalid ip (-1) from call stack. Replacing with -2.";
             addr = -2;
         }
-        auto ret = children.emplace(std::piecewise_construct, std::forward_as_tuple(addr),
-                                    std::forward_as_tuple(next_cctx_ref_));
-        if (ret.second)
-        {
-            next_cctx_ref_++;
-        }
-        return ret.first;
+        return trie_.find_or_insert_child(parent, addr);
     }
 
 private:
     trace::ThreadCctxRefMap& local_cctx_refs_;
-    size_t next_cctx_ref_ = 0;
+    trace::CallingContextTrie& trie_;
+    trace::KernelStackTable& kernel_stacks_;
+    CallchainCache callchain_cache_;
     trace::ThreadCctxRefMap::value_type* current_thread_cctx_refs_ = nullptr;
 };
 } // namespace perf
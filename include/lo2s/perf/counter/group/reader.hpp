@@ -49,15 +49,25 @@ template <class T>
 class Reader : public EventReader<T>
 {
 public:
-    Reader(ExecutionScope scope, bool enable_on_exec);
+    Reader(ExecutionScope scope, bool enable_on_exec, int output_fd = -1);
 
     struct RecordSampleType
     {
         struct perf_event_header header;
+        uint64_t id;
         uint64_t time;
         struct GroupReadFormat v;
     };
 
+    uint64_t record_time(const perf_event_header* header) const
+    {
+        if (header->type == PERF_RECORD_SAMPLE)
+        {
+            return reinterpret_cast<const RecordSampleType*>(header)->time;
+        }
+        return 0;
+    }
+
     ~Reader()
     {
         for (int fd : counter_fds_)
@@ -26,20 +26,29 @@
 #include <lo2s/error.hpp>
 #include <lo2s/log.hpp>
 #include <lo2s/mmap.hpp>
+#include <lo2s/perf/buffer_budget.hpp>
+#include <lo2s/perf/read_stats.hpp>
 #include <lo2s/platform.hpp>
+#include <lo2s/summary.hpp>
 #include <lo2s/util.hpp>
 
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cinttypes>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <vector>
 
 extern "C"
 {
 #include <linux/perf_event.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 }
 
@@ -53,6 +62,10 @@ namespace perf
 template <class T>
 class EventReader
 {
+    // Needed to dispatch records of consolidated readers, see demultiplex()
+    template <class>
+    friend class EventReader;
+
 protected:
     using CRTP = T;
 
@@ -146,6 +159,46 @@ public:
         // struct sample_id sample_id;
     };
 
+    EventReader() = default;
+
+    EventReader(const EventReader&) = delete;
+    EventReader& operator=(const EventReader&) = delete;
+
+    EventReader(EventReader&& other)
+    {
+        *this = std::move(other);
+    }
+
+    EventReader& operator=(EventReader&& other)
+    {
+        // The reader that demultiplexes us holds on to our address
+        if (demultiplexed_ || other.demultiplexed_)
+        {
+            throw std::logic_error("cannot move an EventReader that is demultiplexed by another");
+        }
+
+        std::swap(total_samples, other.total_samples);
+        std::swap(throttle_samples, other.throttle_samples);
+        std::swap(lost_samples, other.lost_samples);
+        std::swap(mmap_pages_, other.mmap_pages_);
+        std::swap(fd_, other.fd_);
+        std::swap(output_fd_, other.output_fd_);
+        std::swap(base, other.base);
+        std::swap(mapping_size_, other.mapping_size_);
+        std::swap(overwrite_, other.overwrite_);
+        std::swap(snapshot_taken_, other.snapshot_taken_);
+        std::swap(snapshot_head_, other.snapshot_head_);
+        std::swap(redirected_fds_, other.redirected_fds_);
+        std::swap(demux_, other.demux_);
+        std::swap(self_metrics_, other.self_metrics_);
+        std::swap(total_stats_, other.total_stats_);
+        std::swap(on_read_, other.on_read_);
+        std::swap(peak_fill_, other.peak_fill_);
+        std::swap(adapt_reads_, other.adapt_reads_);
+        std::swap(adapt_lost_, other.adapt_lost_);
+        return *this;
+    }
+
     ~EventReader()
     {
         if (lost_samples > 0)
@@ -153,19 +206,29 @@ public:
             Log::warn() << "Lost a total of " << lost_samples << " samples in event_reader<"
                         << typeid(CRTP).name() << ">.";
         }
+
+        summary().record_read_stats(total_stats_);
+
+        if (base != nullptr)
+        {
+            munmap(base, mapping_size_);
+
+            // Only the growth beyond -m is charged to the budget
+            BufferBudget::instance().release(mmap_pages_ - config().mmap_pages);
+        }
     }
 
 protected:
-    void init_mmap(int fd)
+    // overwrite must match the write_backward setting of the event. Such buffers are mapped
+    // read-only, so the kernel overwrites old records instead of waiting for us to consume them.
+    void init_mmap(int fd, bool overwrite = false)
     {
         fd_ = fd;
+        overwrite_ = overwrite;
 
         mmap_pages_ = config().mmap_pages;
 
-        base = mmap(NULL, (mmap_pages_ + 1) * get_page_size(), PROT_READ | PROT_WRITE, MAP_SHARED,
-                    fd, 0);
-        // Should not be necessary to check for nullptr, but we've seen it!
-        if (base == MAP_FAILED || base == nullptr)
+        if (!map_buffer())
         {
             Log::error() << "mapping memory for recording events failed. You can try "
                             "to decrease the buffer size with the -m flag, or try to increase "
@@ -175,80 +238,396 @@ protected:
         }
     }
 
+    // Instead of mapping a ring buffer of our own, let the kernel write our records into the ring
+    // buffer of output_fd. The reader owning that buffer has to demultiplex() us.
+    void init_output(int fd, int output_fd)
+    {
+        fd_ = fd;
+        output_fd_ = output_fd;
+
+        if (ioctl(fd_, PERF_EVENT_IOC_SET_OUTPUT, output_fd_) == -1)
+        {
+            Log::error() << "redirecting perf events into a shared ring buffer failed";
+            throw_errno();
+        }
+    }
+
+    // Let the kernel write the records of another event into our ring buffer. The redirection is
+    // renewed whenever the buffer is remapped.
+    void redirect_output(int other_fd)
+    {
+        if (ioctl(other_fd, PERF_EVENT_IOC_SET_OUTPUT, output_fd_ != -1 ? output_fd_ : fd_) == -1)
+        {
+            throw_errno();
+        }
+        redirected_fds_.push_back(other_fd);
+    }
+
 public:
-    void read()
+    /*
+     * Take over the records of a reader that was set up with init_output(..., fd()). Its samples
+     * end up in our ring buffer and are told apart by their PERF_SAMPLE_IDENTIFIER, which has to
+     * be the first field of the RecordSampleType of both readers. Other records (lost, throttle,
+     * ...) are handled by us.
+     *
+     * We keep references to other, so it must neither move nor die before us. Moving it throws.
+     */
+    template <class U>
+    void demultiplex(EventReader<U>& other)
+    {
+        assert(other.base == nullptr);
+
+        auto fds = other.redirected_fds_;
+        fds.push_back(other.fd_);
+
+        for (int fd : fds)
+        {
+            uint64_t id;
+            if (ioctl(fd, PERF_EVENT_IOC_ID, &id) == -1)
+            {
+                throw_errno();
+            }
+
+            demux_.push_back(
+                { id, [&other](perf_event_header* record) { return other.handle_record(record); },
+                  [&other](const perf_event_header* record) {
+                      return static_cast<U&>(other).record_time(record);
+                  } });
+        }
+
+        // Keep the redirections alive if our buffer gets remapped
+        redirected_fds_.insert(redirected_fds_.end(), fds.begin(), fds.end());
+        other.demultiplexed_ = true;
+    }
+
+private:
+    bool map_buffer()
     {
-        int64_t read_samples = 0;
-        while (!empty())
+        mapping_size_ = (mmap_pages_ + 1) * get_page_size();
+        base = mmap(NULL, mapping_size_, prot(), MAP_SHARED, fd_, 0);
+        // Should not be necessary to check for nullptr, but we've seen it!
+        if (base == MAP_FAILED || base == nullptr)
         {
-            auto event_header_p = get();
-            read_samples++;
-            bool stop = false;
-            auto crtp_this = static_cast<CRTP*>(this);
+            base = nullptr;
+            return false;
+        }
+        return true;
+    }
 
-            switch (event_header_p->type)
+    /*
+     * Adjust the buffer size to what we have seen since the last adjustment: Double it if records
+     * were lost or it ran nearly full, halve it if it stayed below a quarter for a while. The
+     * wakeup watermark is derived from -m, so we never shrink below that.
+     *
+     * The kernel throws away the contents of the buffer once it is unmapped, so this must only
+     * be called right after draining the buffer.
+     */
+    void adapt_buffer_size()
+    {
+        constexpr int64_t shrink_interval = 64;
+
+        if (lost_samples > adapt_lost_ || peak_fill_ > data_size() / 10 * 9)
+        {
+            resize_buffer(mmap_pages_ * 2);
+        }
+        else if (++adapt_reads_ < shrink_interval)
+        {
+            return;
+        }
+        else if (peak_fill_ < data_size() / 4 && mmap_pages_ > config().mmap_pages)
+        {
+            resize_buffer(mmap_pages_ / 2);
+        }
+
+        peak_fill_ = 0;
+        adapt_reads_ = 0;
+        adapt_lost_ = lost_samples;
+    }
+
+    void resize_buffer(size_t pages)
+    {
+        auto& budget = BufferBudget::instance();
+
+        if (pages > mmap_pages_ && !budget.try_acquire(pages - mmap_pages_))
+        {
+            Log::debug() << "perf buffer budget exhausted, keeping " << mmap_pages_
+                         << " pages in event_reader<" << typeid(CRTP).name() << ">.";
+            return;
+        }
+
+        // The event stays enabled, so stop the kernel from writing into the buffer and hand out
+        // whatever arrived since the caller drained it. Otherwise these records would vanish
+        // with the old mapping.
+        if (!pause_output(true))
+        {
+            Log::debug() << "pausing the perf buffer failed, keeping " << mmap_pages_
+                         << " pages in event_reader<" << typeid(CRTP).name()
+                         << ">: " << strerror(errno);
+            if (pages > mmap_pages_)
             {
-            case PERF_RECORD_MMAP:
-                stop = crtp_this->handle((const RecordMmapType*)event_header_p);
-                break;
-            case PERF_RECORD_MMAP2:
-                stop = crtp_this->handle((const RecordMmap2Type*)event_header_p);
-                break;
-            case PERF_RECORD_SWITCH:
-                stop = crtp_this->handle((const RecordSwitchType*)event_header_p);
-                break;
-            case PERF_RECORD_SWITCH_CPU_WIDE:
-                stop = crtp_this->handle((const RecordSwitchCpuWideType*)event_header_p);
-                break;
-            case PERF_RECORD_THROTTLE: /* fall-through */
-            case PERF_RECORD_UNTHROTTLE:
-                throttle_samples++;
-                break;
-            case PERF_RECORD_LOST:
+                budget.release(pages - mmap_pages_);
+            }
+            return;
+        }
+
+        // A handler asked to stop, leave the rest of the records to the next read()
+        if (!drain_paused())
+        {
+            pause_output(false);
+            if (pages > mmap_pages_)
             {
-                auto lost = (const RecordLostType*)event_header_p;
-                lost_samples += lost->lost;
-                Log::warn() << "Lost " << lost->lost << " samples during this chunk.";
-                break;
+                budget.release(pages - mmap_pages_);
             }
-#ifdef HAVE_PERF_RECORD_LOST_SAMPLES
-            case PERF_RECORD_LOST_SAMPLES:
+            return;
+        }
+
+        // The new buffer starts out unpaused
+        auto old_pages = mmap_pages_;
+        munmap(base, mapping_size_);
+
+        mmap_pages_ = pages;
+        if (!map_buffer())
+        {
+            Log::warn() << "resizing perf buffer to " << pages
+                        << " pages failed: " << strerror(errno);
+            mmap_pages_ = old_pages;
+            if (!map_buffer())
             {
-                auto lost = (const RecordLostSamplesType*)event_header_p;
-                lost_samples += lost->lost;
-                Log::warn() << "Lost " << lost->lost << " samples during this chunk.";
-                break;
+                throw_errno();
+            }
+        }
+
+        if (pages > old_pages)
+        {
+            budget.release(pages - mmap_pages_);
+        }
+        else
+        {
+            budget.release(old_pages - mmap_pages_);
+        }
+
+        // The kernel detaches all redirected events once the old buffer is gone
+        for (int other_fd : redirected_fds_)
+        {
+            if (ioctl(other_fd, PERF_EVENT_IOC_SET_OUTPUT, fd_) == -1)
+            {
+                throw_errno();
             }
+        }
+
+        Log::debug() << "resized perf buffer of event_reader<" << typeid(CRTP).name() << "> from "
+                     << old_pages << " to " << mmap_pages_ << " pages.";
+    }
+
+    // Stop or resume writing into our buffer, the kernel discards records in the meantime
+    bool pause_output(bool pause)
+    {
+#ifdef HAVE_PERF_WRITE_BACKWARD
+        return ioctl(fd_, PERF_EVENT_IOC_PAUSE_OUTPUT, pause ? 1 : 0) != -1;
+#else
+        // PERF_EVENT_IOC_PAUSE_OUTPUT came with write_backward in Linux 4.7
+        (void)pause;
+        errno = ENOTSUP;
+        return false;
 #endif
-            case PERF_RECORD_EXIT:
-                // We might get those as a side effect of time synchronization,
-                // when using HW_BREAKPOINT_COMPAT, so ignore
-                break;
-            case PERF_RECORD_FORK:
-                stop = crtp_this->handle((const RecordForkType*)event_header_p);
-                break;
-            case PERF_RECORD_SAMPLE:
+    }
+
+    // Hand out all records of a paused buffer, returns false if a handler asked to stop
+    bool drain_paused()
+    {
+        auto cur_tail = data_tail();
+        const auto cur_head = data_head();
+        while (cur_tail != cur_head)
+        {
+            auto event_header_p = get(cur_head, cur_tail);
+            bool stop = handle_record(event_header_p);
+            cur_tail += event_header_p->size;
+            if (stop)
+            {
+                data_tail(cur_tail);
+                return false;
+            }
+        }
+        data_tail(cur_tail);
+        return true;
+    }
+
+    int prot() const
+    {
+        return overwrite_ ? PROT_READ : PROT_READ | PROT_WRITE;
+    }
+
+public:
+    /*
+     * Drain all records from the ring buffer and dispatch them to the CRTP handle() functions.
+     *
+     * Instead of fetching data_head and publishing data_tail for every single record, this takes
+     * a snapshot of data_head, walks all records up to it and only then publishes the new
+     * data_tail. To give the kernel space back during long drains, data_tail is also published
+     * whenever more than a quarter of the buffer has been consumed.
+     */
+    void read()
+    {
+        // Our records are read by the owner of the shared ring buffer
+        if (base == nullptr)
+        {
+            return;
+        }
+
+#ifdef HAVE_PERF_WRITE_BACKWARD
+        if (overwrite_)
+        {
+            read_snapshot();
+            return;
+        }
+#endif
+
+        // Taking timestamps is too expensive to do it for every read() without --self-metrics
+        std::chrono::steady_clock::time_point start;
+        if (self_metrics_)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+        const auto lost_before = lost_samples;
+        const auto throttled_before = throttle_samples;
+        ReadStats stats;
+
+        const uint64_t release_bytes = data_size() / 4;
+
+        auto cur_tail = data_tail();
+        auto released_tail = cur_tail;
+        auto cur_head = data_head();
+        bool stop = false;
+
+        stats.fill_percent = (cur_head - cur_tail) * 100 / data_size();
+
+        for (; !stop && cur_head != cur_tail; cur_head = data_head())
+        {
+            peak_fill_ = std::max(peak_fill_, cur_head - cur_tail);
+
+            while (cur_tail != cur_head)
+            {
+                auto event_header_p = get(cur_head, cur_tail);
+                stats.records++;
+                stats.bytes += event_header_p->size;
+                stop = handle_record(event_header_p);
+                cur_tail += event_header_p->size;
+
+                if (stop)
+                {
+                    break;
+                }
+
+                if (cur_tail - released_tail > release_bytes)
+                {
+                    data_tail(cur_tail);
+                    released_tail = cur_tail;
+                }
+            }
+        }
+
+        if (cur_tail != released_tail)
+        {
+            data_tail(cur_tail);
+        }
+        LO2S_HOT_LOG(trace) << "read " << stats.records << " samples.";
+
+        if (config().adaptive_buffers && !stop && data_head() == cur_tail)
+        {
+            adapt_buffer_size();
+        }
+
+        if (self_metrics_)
+        {
+            stats.lost = lost_samples - lost_before;
+            stats.throttled = throttle_samples - throttled_before;
+            stats.duration = std::chrono::steady_clock::now() - start;
+            total_stats_ += stats;
+            if (on_read_)
+            {
+                on_read_(stats);
+            }
+        }
+    }
+
+    // Called with the statistics of every read(), see --self-metrics
+    void on_read(std::function<void(const ReadStats&)> callback)
+    {
+        on_read_ = std::move(callback);
+    }
+
+private:
+#ifdef HAVE_PERF_WRITE_BACKWARD
+    /*
+     * In a backward buffer, data_head points to the newest record and all older records follow
+     * behind it, until the buffer is full or a record has been partially overwritten. Walk them
+     * newest to oldest until they leave the flight recorder time window and then hand them to the
+     * CRTP handle() functions in chronological order.
+     *
+     * Records that an earlier snapshot already handed out are skipped, so reading again without
+     * new data in between does nothing.
+     */
+    void read_snapshot()
+    {
+        if (ioctl(fd_, PERF_EVENT_IOC_PAUSE_OUTPUT, 1) == -1)
+        {
+            Log::warn() << "pausing the perf buffer failed, the snapshot may be inconsistent: "
+                        << strerror(errno);
+        }
+
+        const auto head = data_head();
+        const uint64_t window = config().flight_recorder_window.count();
+        uint64_t newest_time = 0;
+        std::vector<uint64_t> records;
+
+        for (auto pos = head; pos - head + sizeof(perf_event_header) <= data_size();)
+        {
+            // Older records have been read by the last snapshot
+            if (snapshot_taken_ && pos == snapshot_head_)
             {
-                // Use CRTP here because the struct type depends on the perf attr
-                using ActualSampleType = typename CRTP::RecordSampleType;
-                stop = crtp_this->handle((const ActualSampleType*)event_header_p);
                 break;
             }
-            case PERF_RECORD_COMM:
-                stop = crtp_this->handle((const RecordCommType*)event_header_p);
+
+            auto size = reinterpret_cast<perf_event_header*>(data() + pos % data_size())->size;
+            if (size == 0 || pos - head + size > data_size())
+            {
                 break;
-            default:
-                stop = crtp_this->handle((const RecordUnknownType*)event_header_p);
             }
-            pop();
-            if (stop)
+
+            auto time = any_record_time(record_at(pos));
+            if (time != 0)
+            {
+                if (newest_time == 0)
+                {
+                    newest_time = time;
+                }
+                else if (time + window < newest_time)
+                {
+                    break;
+                }
+            }
+
+            records.push_back(pos);
+            pos += size;
+        }
+
+        for (auto it = records.rbegin(); it != records.rend(); ++it)
+        {
+            if (handle_record(record_at(*it)))
             {
                 break;
             }
         }
-        Log::trace() << "read " << read_samples << " samples.";
+        Log::debug() << "read " << records.size() << " records from flight recorder buffer.";
+
+        snapshot_taken_ = true;
+        snapshot_head_ = head;
+
+        ioctl(fd_, PERF_EVENT_IOC_PAUSE_OUTPUT, 0);
     }
+#endif
 
+public:
     void pop()
     {
         auto* ev = get();
@@ -262,25 +641,128 @@ public:
 
     perf_event_header* get()
     {
-        auto cur_head = data_head();
-        auto cur_tail = data_tail();
+        return get(data_head(), data_tail());
+    }
+
+private:
+    struct Demultiplexed
+    {
+        uint64_t id;
+        std::function<bool(perf_event_header*)> handle;
+        std::function<uint64_t(const perf_event_header*)> time;
+    };
+
+    const Demultiplexed* find_demultiplexed(const perf_event_header* record) const
+    {
+        if (demux_.empty() || record->type != PERF_RECORD_SAMPLE)
+        {
+            return nullptr;
+        }
+
+        // PERF_SAMPLE_IDENTIFIER directly follows the header
+        auto id = *reinterpret_cast<const uint64_t*>(record + 1);
+        for (const auto& entry : demux_)
+        {
+            if (entry.id == id)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    uint64_t any_record_time(const perf_event_header* record)
+    {
+        if (auto entry = find_demultiplexed(record))
+        {
+            return entry->time(record);
+        }
+        return static_cast<CRTP*>(this)->record_time(record);
+    }
 
+    bool handle_record(perf_event_header* event_header_p)
+    {
+        if (auto entry = find_demultiplexed(event_header_p))
+        {
+            return entry->handle(event_header_p);
+        }
+
+        auto crtp_this = static_cast<CRTP*>(this);
+
+        switch (event_header_p->type)
+        {
+        case PERF_RECORD_MMAP:
+            return crtp_this->handle((const RecordMmapType*)event_header_p);
+        case PERF_RECORD_MMAP2:
+            return crtp_this->handle((const RecordMmap2Type*)event_header_p);
+        case PERF_RECORD_SWITCH:
+            return crtp_this->handle((const RecordSwitchType*)event_header_p);
+        case PERF_RECORD_SWITCH_CPU_WIDE:
+            return crtp_this->handle((const RecordSwitchCpuWideType*)event_header_p);
+        case PERF_RECORD_THROTTLE: /* fall-through */
+        case PERF_RECORD_UNTHROTTLE:
+            throttle_samples++;
+            break;
+        case PERF_RECORD_LOST:
+        {
+            auto lost = (const RecordLostType*)event_header_p;
+            lost_samples += lost->lost;
+            Log::warn() << "Lost " << lost->lost << " samples during this chunk.";
+            break;
+        }
+#ifdef HAVE_PERF_RECORD_LOST_SAMPLES
+        case PERF_RECORD_LOST_SAMPLES:
+        {
+            auto lost = (const RecordLostSamplesType*)event_header_p;
+            lost_samples += lost->lost;
+            Log::warn() << "Lost " << lost->lost << " samples during this chunk.";
+            break;
+        }
+#endif
+        case PERF_RECORD_EXIT:
+            // We might get those as a side effect of time synchronization,
+            // when using HW_BREAKPOINT_COMPAT, so ignore
+            break;
+        case PERF_RECORD_FORK:
+            return crtp_this->handle((const RecordForkType*)event_header_p);
+        case PERF_RECORD_SAMPLE:
+        {
+            total_samples++;
+            // Use CRTP here because the struct type depends on the perf attr
+            using ActualSampleType = typename CRTP::RecordSampleType;
+            return crtp_this->handle((const ActualSampleType*)event_header_p);
+        }
+        case PERF_RECORD_COMM:
+            return crtp_this->handle((const RecordCommType*)event_header_p);
+        default:
+            return crtp_this->handle((const RecordUnknownType*)event_header_p);
+        }
+        return false;
+    }
+
+    perf_event_header* get(uint64_t cur_head, uint64_t cur_tail)
+    {
         assert(cur_tail <= cur_head);
-        Log::trace() << "head: " << cur_head << ", tail: " << cur_tail;
+        LO2S_HOT_LOG(trace) << "head: " << cur_head << ", tail: " << cur_tail;
 
         // Unless there is a serious kernel bug, the kernel will
         // always throw away
         // events on overflow and write PERF_RECORD_LOST events
         assert(cur_head - cur_tail <= data_size());
 
+        auto event_header_p = record_at(cur_tail);
+        assert(cur_tail + event_header_p->size <= cur_head);
+        return event_header_p;
+    }
+
+    perf_event_header* record_at(uint64_t pos)
+    {
         auto d = data();
 
-        auto index = cur_tail % data_size();
+        auto index = pos % data_size();
         auto event_header_p = (struct perf_event_header*)(d + index);
         auto len = event_header_p->size;
 
-        assert(cur_tail + len <= cur_head);
-
         // Event spans the wrap-around of the ring buffer
         if (index + len > data_size())
         {
@@ -299,7 +781,6 @@ public:
         return event_header_p;
     }
 
-private:
     const struct perf_event_mmap_page* header() const
     {
         return (const struct perf_event_mmap_page*)base;
@@ -354,6 +835,13 @@ public:
         return false;
     }
 
+    // Readers override this with the timestamp of the records they know, to bound flight recorder
+    // snapshots in time. 0 means the time of the record is unknown.
+    uint64_t record_time(const perf_event_header*) const
+    {
+        return 0;
+    }
+
     template <class UNKNOWN_RECORD_TYPE>
     bool handle(const UNKNOWN_RECORD_TYPE* record)
     {
@@ -369,8 +857,24 @@ protected:
     size_t mmap_pages_ = 0;
 
 private:
-    int fd_;
-    void* base;
+    int fd_ = -1;
+    int output_fd_ = -1;
+    void* base = nullptr;
+    size_t mapping_size_ = 0;
+    bool overwrite_ = false;
+    // Another reader dispatches our records, see demultiplex()
+    bool demultiplexed_ = false;
+    // data_head of the last flight recorder snapshot
+    bool snapshot_taken_ = false;
+    uint64_t snapshot_head_ = 0;
+    std::vector<int> redirected_fds_;
+    std::vector<Demultiplexed> demux_;
+    bool self_metrics_ = config().self_metrics;
+    ReadStats total_stats_;
+    std::function<void(const ReadStats&)> on_read_;
+    uint64_t peak_fill_ = 0;
+    int64_t adapt_reads_ = 0;
+    int64_t adapt_lost_ = 0;
     std::byte event_copy[PERF_SAMPLE_MAX_SIZE] __attribute__((aligned(8)));
 };
 
@@ -0,0 +1,57 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace lo2s
+{
+namespace perf
+{
+
+// What a reader did in one read(), or in many read()s combined. See --self-metrics.
+struct ReadStats
+{
+    std::uint64_t records = 0;
+    std::uint64_t bytes = 0;
+    // Percentage of the ring buffer that was filled when read() was called. Combined stats keep
+    // the maximum.
+    std::uint64_t fill_percent = 0;
+    std::chrono::nanoseconds duration = std::chrono::nanoseconds(0);
+    std::uint64_t lost = 0;
+    std::uint64_t throttled = 0;
+
+    ReadStats& operator+=(const ReadStats& other)
+    {
+        records += other.records;
+        bytes += other.bytes;
+        fill_percent = std::max(fill_percent, other.fill_percent);
+        duration += other.duration;
+        lost += other.lost;
+        throttled += other.throttled;
+        return *this;
+    }
+};
+} // namespace perf
+} // namespace lo2s
@@ -0,0 +1,160 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C"
+{
+#include <linux/perf_event.h>
+}
+
+namespace lo2s
+{
+namespace perf
+{
+
+/*
+ * Bounded buffer that restores the timestamp order of perf records.
+ *
+ * Records are copied into one of `capacity` slots and kept in a min-heap keyed by their perf time.
+ * As soon as all slots are taken, the oldest record is emitted. Thus, records are emitted in order
+ * as long as no record is overtaken by more than `capacity` newer ones. Slots keep their storage,
+ * so nothing is allocated anymore once every slot has seen the largest record.
+ */
+class ReorderBuffer
+{
+public:
+    ReorderBuffer(std::size_t capacity) : slots_(capacity)
+    {
+        heap_.reserve(capacity);
+        free_.reserve(capacity);
+        for (std::size_t i = capacity; i-- > 0;)
+        {
+            free_.push_back(i);
+        }
+    }
+
+    bool enabled() const
+    {
+        return !slots_.empty();
+    }
+
+    template <typename Emit>
+    void push(uint64_t time, const perf_event_header* record, Emit&& emit)
+    {
+        if (time < newest_time_)
+        {
+            reordered_++;
+        }
+        else
+        {
+            newest_time_ = time;
+        }
+
+        if (free_.empty())
+        {
+            // The new record is older than everything buffered, so it can be emitted right away
+            if (!(heap_.front() < Entry{ time, seq_, 0 }))
+            {
+                seq_++;
+                emit(record);
+                return;
+            }
+            emit_oldest(emit);
+        }
+
+        auto slot = free_.back();
+        free_.pop_back();
+
+        auto& storage = slots_[slot];
+        storage.resize((record->size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        std::memcpy(storage.data(), record, record->size);
+
+        heap_.push_back(Entry{ time, seq_++, slot });
+        std::push_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+    }
+
+    template <typename Emit>
+    void drain(Emit&& emit)
+    {
+        while (!heap_.empty())
+        {
+            emit_oldest(emit);
+        }
+    }
+
+    // Number of records that arrived after a newer one
+    std::size_t reordered() const
+    {
+        return reordered_;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t time;
+        // keeps records with the same time in arrival order
+        uint64_t seq;
+        std::size_t slot;
+
+        bool operator<(const Entry& other) const
+        {
+            return time < other.time || (time == other.time && seq < other.seq);
+        }
+
+        bool operator>(const Entry& other) const
+        {
+            return other < *this;
+        }
+    };
+
+    template <typename Emit>
+    void emit_oldest(Emit&& emit)
+    {
+        std::pop_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+        auto slot = heap_.back().slot;
+        heap_.pop_back();
+
+        // The slot is only handed out again after emit() returns
+        emit(reinterpret_cast<const perf_event_header*>(slots_[slot].data()));
+        free_.push_back(slot);
+    }
+
+    // 8-byte words keep the records aligned
+    std::vector<std::vector<uint64_t>> slots_;
+    std::vector<Entry> heap_;
+    std::vector<std::size_t> free_;
+
+    uint64_t newest_time_ = 0;
+    uint64_t seq_ = 0;
+    std::size_t reordered_ = 0;
+};
+} // namespace perf
+} // namespace lo2s
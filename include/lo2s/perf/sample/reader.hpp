@@ -23,6 +23,7 @@
 
 #include <lo2s/perf/event_provider.hpp>
 #include <lo2s/perf/event_reader.hpp>
+#include <lo2s/perf/sample/user_stack.hpp>
 #include <lo2s/perf/util.hpp>
 
 #include <lo2s/config.hpp>
@@ -67,6 +68,7 @@ public:
         RecordSampleType& operator=(RecordSampleType&&) = delete;
 
         struct perf_event_header header;
+        uint64_t id;
         uint64_t ip;
         uint32_t pid, tid;
         uint64_t time;
@@ -79,7 +81,10 @@ public:
 protected:
     using EventReader<T>::init_mmap;
 
-    Reader(ExecutionScope scope, bool enable_on_exec) : has_cct_(config().enable_cct)
+    // With a valid inherit_from, scope must be a CPU and only inherit_from and the threads and
+    // processes it creates are sampled on it.
+    Reader(ExecutionScope scope, bool enable_on_exec, Process inherit_from = Process::invalid())
+    : has_cct_(config().enable_cct)
     {
         Log::debug() << "initializing event_reader for:" << scope.name()
                      << ", enable_on_exec: " << enable_on_exec;
@@ -124,6 +129,14 @@ protected:
         perf_attr.comm = 1;
         perf_attr.context_switch = 1;
 
+        if (inherit_from != Process::invalid())
+        {
+            assert(scope.is_cpu());
+            perf_attr.inherit = 1;
+            // New threads are not reported by ptrace, so we need the fork records
+            perf_attr.task = 1;
+        }
+
         // We need this to get all mmap_events
         if (enable_on_exec)
         {
@@ -131,19 +144,40 @@ protected:
         }
 
         // TODO see if we can remove remove tid
-        perf_attr.sample_type =
-            PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU;
+        perf_attr.sample_type = PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_IP | PERF_SAMPLE_TID |
+                                PERF_SAMPLE_TIME | PERF_SAMPLE_CPU;
         if (has_cct_)
         {
             perf_attr.sample_type |= PERF_SAMPLE_CALLCHAIN;
         }
 
+        // The user part of the call stack is unwound from the registers and the stack after
+        // recording, the kernel still provides the kernel part.
+        if (config().dwarf_unwind)
+        {
+            perf_attr.sample_type |= PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+            perf_attr.sample_regs_user = USER_REGS_MASK;
+            perf_attr.sample_stack_user = config().stack_dump_size;
+            perf_attr.exclude_callchain_user = 1;
+        }
+
+#ifdef HAVE_PERF_WRITE_BACKWARD
+        perf_attr.write_backward = config().flight_recorder;
+#endif
+
         perf_attr.precise_ip = 3;
         /* precise_ip is an unsigned integer therefore we have to check if we get an underflow
          * and the value of it is greater than the initial value */
         do
         {
-            fd_ = perf_event_open(&perf_attr, scope, -1, 0, config().cgroup_fd);
+            if (inherit_from != Process::invalid())
+            {
+                fd_ = perf_event_open(&perf_attr, scope.as_cpu(), inherit_from, -1, 0);
+            }
+            else
+            {
+                fd_ = perf_event_open(&perf_attr, scope, -1, 0, config().cgroup_fd);
+            }
 
             if (errno == EACCES && !perf_attr.exclude_kernel && perf_event_paranoid() > 1)
             {
@@ -182,7 +216,7 @@ protected:
                 throw_errno();
             }
 
-            init_mmap(fd_);
+            init_mmap(fd_, config().flight_recorder);
             Log::debug() << "mmap initialized";
 
             if (!enable_on_exec)
@@ -224,6 +258,47 @@ protected:
     }
 
 public:
+    // Only valid with --call-graph-dwarf, the registers and the stack follow the callchain
+    UserStack user_stack(const RecordSampleType* sample) const
+    {
+        const uint64_t* pos = sample->ips + sample->nr;
+
+        UserStack stack;
+        stack.abi = *pos++;
+        if (stack.abi != PERF_SAMPLE_REGS_ABI_NONE)
+        {
+            stack.regs = pos;
+            pos += NUM_USER_REGS;
+        }
+
+        auto dump_size = *pos++;
+        if (dump_size != 0)
+        {
+            stack.data = reinterpret_cast<const char*>(pos);
+            // The number of bytes that were actually dumped follows the dump
+            stack.size = *reinterpret_cast<const uint64_t*>(stack.data + dump_size);
+        }
+        return stack;
+    }
+
+    uint64_t record_time(const perf_event_header* header) const
+    {
+        switch (header->type)
+        {
+        case PERF_RECORD_SAMPLE:
+            return reinterpret_cast<const RecordSampleType*>(header)->time;
+        case PERF_RECORD_SWITCH:
+            return reinterpret_cast<const typename EventReader<T>::RecordSwitchType*>(header)
+                ->time;
+        case PERF_RECORD_SWITCH_CPU_WIDE:
+            return reinterpret_cast<const typename EventReader<T>::RecordSwitchCpuWideType*>(
+                       header)
+                ->time;
+        default:
+            return 0;
+        }
+    }
+
     void close()
     {
         if (fd_ != -1)
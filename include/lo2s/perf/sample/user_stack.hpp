@@ -0,0 +1,73 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C"
+{
+#if defined(__x86_64__)
+#include <asm/perf_regs.h>
+#endif
+}
+
+namespace lo2s
+{
+namespace perf
+{
+namespace sample
+{
+
+#if defined(__x86_64__)
+// The registers that DWARF unwinding starts from, see --call-graph-dwarf. perf writes them in the
+// order of their bits in the mask.
+constexpr uint64_t USER_REGS_MASK =
+    (1ull << PERF_REG_X86_AX) | (1ull << PERF_REG_X86_BX) | (1ull << PERF_REG_X86_CX) |
+    (1ull << PERF_REG_X86_DX) | (1ull << PERF_REG_X86_SI) | (1ull << PERF_REG_X86_DI) |
+    (1ull << PERF_REG_X86_BP) | (1ull << PERF_REG_X86_SP) | (1ull << PERF_REG_X86_IP) |
+    (1ull << PERF_REG_X86_R8) | (1ull << PERF_REG_X86_R9) | (1ull << PERF_REG_X86_R10) |
+    (1ull << PERF_REG_X86_R11) | (1ull << PERF_REG_X86_R12) | (1ull << PERF_REG_X86_R13) |
+    (1ull << PERF_REG_X86_R14) | (1ull << PERF_REG_X86_R15);
+constexpr std::size_t NUM_USER_REGS = 17;
+// Positions within the recorded registers
+constexpr std::size_t USER_REG_SP = 7;
+constexpr std::size_t USER_REG_IP = 8;
+#else
+constexpr uint64_t USER_REGS_MASK = 0;
+constexpr std::size_t NUM_USER_REGS = 0;
+#endif
+
+// The user space registers and the dump of the user stack of a sample. Points into the record.
+struct UserStack
+{
+    // PERF_SAMPLE_REGS_ABI_NONE if the sample was taken in a kernel thread
+    uint64_t abi = 0;
+    const uint64_t* regs = nullptr;
+    // Number of bytes of the stack that were actually dumped
+    uint64_t size = 0;
+    const char* data = nullptr;
+};
+} // namespace sample
+} // namespace perf
+} // namespace lo2s
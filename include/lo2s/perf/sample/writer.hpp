@@ -22,8 +22,11 @@
 #pragma once
 
 #include <lo2s/address.hpp>
+#include <lo2s/config.hpp>
+#include <lo2s/metric/change_filter.hpp>
 #include <lo2s/mmap.hpp>
 #include <lo2s/perf/calling_context_manager.hpp>
+#include <lo2s/perf/reorder_buffer.hpp>
 
 #include <lo2s/perf/sample/reader.hpp>
 #include <lo2s/perf/time/converter.hpp>
@@ -34,6 +37,7 @@
 #include <otf2xx/definition/location.hpp>
 
 #include <cstdint>
+#include <optional>
 #include <unordered_map>
 
 extern "C"
@@ -58,7 +62,7 @@ class Writer : public Reader<Writer>
 {
 public:
     Writer(ExecutionScope scope, monitor::MainMonitor& monitor, trace::Trace& trace,
-           bool enable_on_exec);
+           bool enable_on_exec, Process inherit_from = Process::invalid());
     ~Writer();
 
 public:
@@ -68,6 +72,7 @@ public:
     bool handle(const Reader::RecordCommType* comm);
     bool handle(const Reader::RecordSwitchCpuWideType* context_switch);
     bool handle(const Reader::RecordSwitchType* context_switch);
+    bool handle(const Reader::RecordForkType* fork);
 
     void end();
 
@@ -76,8 +81,20 @@ private:
     void update_calling_context(Process process, Thread thread, otf2::chrono::time_point tp,
                                 bool switch_out);
 
+    // With --reorder-window, samples and context switches are only written once they are in order
+    void reorder(uint64_t time, const perf_event_header* record);
+    void drain_reorder_buffer();
+    void write_ordered(const perf_event_header* record);
+    void write_sample(const Reader::RecordSampleType* sample);
+    CallingContextManager::SampleRef sample_ref(const Reader::RecordSampleType* sample);
+    void write_switch(const Reader::RecordSwitchType* context_switch);
+    void write_switch_cpu_wide(const Reader::RecordSwitchCpuWideType* context_switch);
+
     void leave_current_thread(Thread thread, otf2::chrono::time_point tp);
     otf2::chrono::time_point adjust_timepoints(otf2::chrono::time_point tp);
+    void flush_calling_contexts(otf2::chrono::time_point tp);
+    void write_profile();
+    void write_cpuid(otf2::chrono::time_point tp, int64_t cpu);
 
     ExecutionScope scope_;
 
@@ -88,6 +105,21 @@ private:
 
     otf2::definition::metric_instance cpuid_metric_instance_;
     otf2::event::metric cpuid_metric_event_;
+    metric::ChangeFilter cpuid_filter_{ 1, config().cpuid_suppress_unchanged, 0,
+                                        config().cpuid_heartbeat };
+
+    // With --profile-window, samples are only counted per calling context until the window is over
+    // or the current thread changes
+    struct ProfileEntry
+    {
+        uint64_t count;
+        uint64_t unwind_distance;
+    };
+    std::optional<otf2::event::metric> profile_metric_event_;
+    // Keyed by calling context reference
+    std::unordered_map<uint64_t, ProfileEntry> profile_;
+    otf2::chrono::time_point profile_window_end_;
+    otf2::chrono::time_point last_sample_time_point_;
 
     CallingContextManager cctx_manager_;
     RawMemoryMapCache cached_mmap_events_;
@@ -98,6 +130,11 @@ private:
     bool first_event_ = true;
     otf2::chrono::time_point first_time_point_;
     otf2::chrono::time_point last_time_point_;
+    otf2::chrono::time_point last_cctx_flush_;
+
+    ReorderBuffer reorder_buffer_;
+    // Records that were out of order despite the reorder buffer
+    std::size_t clamped_timestamps_ = 0;
 };
 } // namespace sample
 } // namespace perf
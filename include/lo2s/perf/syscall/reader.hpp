@@ -66,13 +66,17 @@ public:
         uint64_t args[6];
     };
 
-    Reader(Cpu cpu) : cpu_(cpu)
+    // With output_fd, the records are written into the ring buffer of that event instead
+    Reader(Cpu cpu, int output_fd = -1) : cpu_(cpu)
     {
         struct perf_event_attr attr = common_perf_event_attrs();
         attr.type = PERF_TYPE_TRACEPOINT;
         attr.config = tracepoint::EventFormat("raw_syscalls:sys_enter").id();
         attr.sample_period = 1;
         attr.sample_type = PERF_SAMPLE_RAW | PERF_SAMPLE_TIME | PERF_SAMPLE_IDENTIFIER;
+#ifdef HAVE_PERF_WRITE_BACKWARD
+        attr.write_backward = config().flight_recorder;
+#endif
 
         fd_ = perf_event_open(&attr, cpu.as_scope(), -1, 0, config().cgroup_fd);
         if (fd_ < 0)
@@ -97,12 +101,16 @@ public:
                 throw_errno();
             }
 
-            init_mmap(fd_);
-            Log::debug() << "perf_tracepoint_reader mmap initialized";
-            if (ioctl(other_fd_, PERF_EVENT_IOC_SET_OUTPUT, fd_) == -1)
+            if (output_fd != -1)
             {
-                throw_errno();
+                this->init_output(fd_, output_fd);
+            }
+            else
+            {
+                init_mmap(fd_, config().flight_recorder);
+                Log::debug() << "perf_tracepoint_reader mmap initialized";
             }
+            this->redirect_output(other_fd_);
             if (!config().syscall_filter.empty())
             {
                 std::vector<std::string> names;
@@ -164,6 +172,15 @@ public:
         }
     }
 
+    uint64_t record_time(const perf_event_header* header) const
+    {
+        if (header->type == PERF_RECORD_SAMPLE)
+        {
+            return reinterpret_cast<const RecordSampleType*>(header)->time;
+        }
+        return 0;
+    }
+
     void stop()
     {
         auto ret = ioctl(fd_, PERF_EVENT_IOC_DISABLE);
@@ -43,7 +43,7 @@ namespace syscall
 class Writer : public Reader<Writer>
 {
 public:
-    Writer(Cpu cpu, trace::Trace& trace);
+    Writer(Cpu cpu, trace::Trace& trace, int output_fd = -1);
 
     Writer(const Writer& other) = delete;
 
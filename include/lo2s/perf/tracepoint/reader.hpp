@@ -106,19 +106,21 @@ public:
     struct RecordSampleType
     {
         struct perf_event_header header;
+        uint64_t id;
         uint64_t time;
         // uint32_t size;
         // char data[size];
         RecordDynamicFormat raw_data;
     };
 
-    Reader(Cpu cpu, int event_id) : cpu_(cpu)
+    // With output_fd, the records are written into the ring buffer of that event instead
+    Reader(Cpu cpu, int event_id, int output_fd = -1) : cpu_(cpu)
     {
         struct perf_event_attr attr = common_perf_event_attrs();
         attr.type = PERF_TYPE_TRACEPOINT;
         attr.config = event_id;
         attr.sample_period = 1;
-        attr.sample_type = PERF_SAMPLE_RAW | PERF_SAMPLE_TIME;
+        attr.sample_type = PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_RAW | PERF_SAMPLE_TIME;
 
         fd_ = perf_event_open(&attr, cpu.as_scope(), -1, 0, config().cgroup_fd);
         if (fd_ < 0)
@@ -138,8 +140,15 @@ public:
                 throw_errno();
             }
 
-            init_mmap(fd_);
-            Log::debug() << "perf_tracepoint_reader mmap initialized";
+            if (output_fd != -1)
+            {
+                this->init_output(fd_, output_fd);
+            }
+            else
+            {
+                init_mmap(fd_);
+                Log::debug() << "perf_tracepoint_reader mmap initialized";
+            }
 
             auto ret = ioctl(fd_, PERF_EVENT_IOC_ENABLE);
             Log::debug() << "perf_tracepoint_reader ioctl(fd, PERF_EVENT_IOC_ENABLE) = " << ret;
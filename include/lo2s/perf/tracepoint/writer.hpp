@@ -45,7 +45,7 @@ class Writer : public Reader<Writer>
 {
 public:
     Writer(Cpu cpu, const EventFormat& event, trace::Trace& trace,
-           const otf2::definition::metric_class& metric_class);
+           const otf2::definition::metric_class& metric_class, int output_fd = -1);
 
     Writer(const Writer& other) = delete;
 
@@ -15,6 +15,9 @@ namespace perf
 int perf_event_paranoid();
 int perf_event_open(struct perf_event_attr* perf_attr, ExecutionScope scope, int group_fd,
                     unsigned long flags, int cgroup_fd = -1);
+// Open an event that only measures process while it runs on cpu
+int perf_event_open(struct perf_event_attr* perf_attr, Cpu cpu, Process process, int group_fd,
+                    unsigned long flags);
 struct perf_event_attr common_perf_event_attrs();
 void perf_warn_paranoid();
 void perf_check_disabled();
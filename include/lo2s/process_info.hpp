@@ -25,6 +25,8 @@
 #include <lo2s/log.hpp>
 #include <lo2s/mmap.hpp>
 
+#include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
 
@@ -33,7 +35,8 @@ namespace lo2s
 class ProcessInfo
 {
 public:
-    ProcessInfo(Process p, bool enable_on_exec) : process_(p), maps_(p, !enable_on_exec)
+    ProcessInfo(Process p, bool enable_on_exec)
+    : process_(p), maps_(std::make_shared<const MemoryMap>(p, !enable_on_exec))
     {
     }
 
@@ -44,20 +47,35 @@ public:
 
     void mmap(const RawMemoryMapEntry& entry)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        maps_.mmap(entry);
+        mmap(&entry, &entry + 1);
     }
 
-    MemoryMap maps() const
+    // Publishes a single new snapshot for all entries in [begin, end)
+    template <class Iterator>
+    void mmap(Iterator begin, Iterator end)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        // Yes, this is correct as per 6.6.3 The Return Statement
-        return maps_;
+        auto maps = std::make_shared<MemoryMap>(*maps_);
+        for (auto it = begin; it != end; ++it)
+        {
+            maps->mmap(*it);
+        }
+        std::atomic_store(&maps_, std::shared_ptr<const MemoryMap>(std::move(maps)));
+    }
+
+    // Snapshots are immutable, so holding on to one is safe while new mappings are published
+    std::shared_ptr<const MemoryMap> maps() const
+    {
+        return std::atomic_load(&maps_);
     }
 
 private:
     const Process process_;
-    mutable std::mutex mutex_;
-    MemoryMap maps_;
+    // Only serializes writers, readers just load the current snapshot
+    std::mutex mutex_;
+    std::shared_ptr<const MemoryMap> maps_;
 };
+
+// Memory map snapshots of all known processes, taken at one point in time
+using ProcessMaps = std::map<Process, std::shared_ptr<const MemoryMap>>;
 } // namespace lo2s
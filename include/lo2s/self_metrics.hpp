@@ -0,0 +1,52 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <lo2s/perf/read_stats.hpp>
+#include <lo2s/trace/fwd.hpp>
+
+#include <otf2xx/definition/metric_instance.hpp>
+#include <otf2xx/event/metric.hpp>
+#include <otf2xx/writer/local.hpp>
+
+#include <string>
+
+namespace lo2s
+{
+
+/*
+ * Writes the overhead of a monitoring thread or one of its perf readers into a metric location of
+ * its own, one event per read() or wakeup. See --self-metrics.
+ */
+class SelfMetrics
+{
+public:
+    SelfMetrics(trace::Trace& trace, const std::string& name);
+
+    void write(const perf::ReadStats& stats);
+
+private:
+    otf2::writer::local& writer_;
+    otf2::definition::metric_instance metric_instance_;
+    otf2::event::metric event_;
+};
+} // namespace lo2s
@@ -0,0 +1,95 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lo2s
+{
+
+/*
+ * Process-wide pool of the file, function and binary names of resolved instructions.
+ *
+ * Every distinct string is stored once and identified by a dense Id. Interning a known string only
+ * takes a shared lock. Looking up the string of an Id takes no lock at all: strings are kept in
+ * chunks of doubling size, which are allocated once and never move.
+ */
+class StringPool
+{
+public:
+    using Id = uint32_t;
+
+    static StringPool& instance()
+    {
+        static StringPool pool;
+        return pool;
+    }
+
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    Id intern(std::string_view str);
+
+    // id must have been returned by intern()
+    const std::string& str(Id id) const
+    {
+        auto [chunk, index] = locate(id);
+        return chunks_[chunk].load(std::memory_order_acquire)[index];
+    }
+
+private:
+    StringPool() = default;
+    ~StringPool();
+
+    // Chunk i holds (1 << (FIRST_CHUNK_BITS + i)) strings, which covers all of Id
+    static constexpr unsigned int FIRST_CHUNK_BITS = 10;
+    static constexpr std::size_t NUM_CHUNKS = 33 - FIRST_CHUNK_BITS;
+
+    static std::size_t chunk_size(std::size_t chunk)
+    {
+        return std::size_t(1) << (chunk + FIRST_CHUNK_BITS);
+    }
+
+    static std::pair<std::size_t, std::size_t> locate(Id id)
+    {
+        uint64_t n = uint64_t(id) + (uint64_t(1) << FIRST_CHUNK_BITS);
+        unsigned int bit = 63 - __builtin_clzll(n);
+        return { bit - FIRST_CHUNK_BITS, n - (uint64_t(1) << bit) };
+    }
+
+    mutable std::shared_mutex mutex_;
+    // Keys are views of the strings in chunks_
+    std::unordered_map<std::string_view, Id> ids_;
+    std::array<std::atomic<std::string*>, NUM_CHUNKS> chunks_{};
+    Id next_id_ = 0;
+};
+} // namespace lo2s
@@ -30,6 +30,7 @@ extern "C"
 #include <sys/types.h>
 }
 
+#include <lo2s/perf/read_stats.hpp>
 #include <lo2s/types.hpp>
 
 namespace lo2s
@@ -44,6 +45,9 @@ public:
     void register_process(Process process);
 
     void record_perf_wakeups(std::size_t num_wakeups);
+    void record_read_stats(const perf::ReadStats& stats);
+    void record_callchain_cache(std::size_t hits, std::size_t lookups);
+    void record_timestamp_order(std::size_t reordered, std::size_t clamped);
 
     void set_exit_code(int exit_code);
     void set_trace_dir(const std::string& trace_dir);
@@ -57,10 +61,17 @@ private:
 
     std::atomic<std::size_t> num_wakeups_;
     std::atomic<std::size_t> thread_count_;
+    std::atomic<std::size_t> callchain_cache_hits_;
+    std::atomic<std::size_t> callchain_cache_lookups_;
+    std::atomic<std::size_t> reordered_timestamps_;
+    std::atomic<std::size_t> clamped_timestamps_;
 
     std::set<Process> processes_;
     std::mutex processes_mutex_;
 
+    perf::ReadStats read_stats_;
+    std::mutex read_stats_mutex_;
+
     std::string trace_dir_;
 
     int exit_code_;
@@ -0,0 +1,81 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+
+#include <cstddef>
+
+namespace lo2s
+{
+namespace elfr
+{
+
+/*
+ * Directory of symbol index images (see elfr::Lib) shared by all lo2s runs, keyed by ELF build-id.
+ *
+ * Images are written to a temporary file and renamed into place, so concurrent runs only ever see
+ * complete images. When the directory grows beyond --symbol-cache-size, the least recently used
+ * images are removed.
+ */
+class SymbolCache
+{
+private:
+    SymbolCache();
+
+public:
+    static SymbolCache& instance()
+    {
+        static SymbolCache c;
+        return c;
+    }
+
+    SymbolCache(const SymbolCache&) = delete;
+    SymbolCache& operator=(const SymbolCache&) = delete;
+
+    bool enabled() const
+    {
+        return !dir_.empty();
+    }
+
+    // Returns the path of the cached image for key, or an empty path if there is none
+    std::filesystem::path find(const std::string& key);
+
+    void store(const std::string& key, const char* data, std::size_t size);
+
+private:
+    void evict();
+
+    std::filesystem::path dir_;
+    std::size_t max_size_;
+
+    std::atomic<std::size_t> next_tmp_ = 0;
+
+    std::mutex mutex_;
+    std::size_t used_ = 0;
+};
+} // namespace elfr
+} // namespace lo2s
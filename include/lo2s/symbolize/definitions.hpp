@@ -0,0 +1,55 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <lo2s/line_info.hpp>
+
+#include <filesystem>
+#include <vector>
+
+#include <cstdint>
+
+namespace lo2s
+{
+namespace symbolize
+{
+
+struct ResolvedSymbol
+{
+    uint32_t region;
+    uint32_t scl;
+    LineInfo line_info;
+};
+
+/*
+ * Replaces the global definitions of the OTF2 archive in trace with a copy in which the given
+ * placeholder regions and source code locations carry their resolved line info.
+ *
+ * All other definitions are copied unchanged, so the local definitions and events stay valid.
+ * Calling contexts of placeholders that resolve to the same function are moved to a single
+ * region.
+ */
+void rewrite_definitions(const std::filesystem::path& trace,
+                         const std::vector<ResolvedSymbol>& symbols);
+} // namespace symbolize
+} // namespace lo2s
@@ -0,0 +1,245 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <lo2s/address.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace lo2s
+{
+namespace trace
+{
+
+/*
+ * Calling context tree of a single sample writer.
+ *
+ * Nodes and their open-addressing child tables are carved out of slabs, which are only ever
+ * released as a whole. Node ids are dense, stable and start at first_id, so that they can directly
+ * be used as writer-local calling context references. A writer that hands off its trie for merging
+ * continues with a new trie that starts where the old one ended.
+ */
+class CallingContextTrie
+{
+public:
+    using NodeId = uint32_t;
+
+    static constexpr NodeId INVALID_NODE = -1u;
+
+    CallingContextTrie(NodeId first_id = 0) : first_id_(first_id)
+    {
+    }
+
+    CallingContextTrie(const CallingContextTrie&) = delete;
+    CallingContextTrie& operator=(const CallingContextTrie&) = delete;
+
+    // Slabs are heap allocated, so moving keeps all child table pointers valid
+    CallingContextTrie(CallingContextTrie&&) = default;
+    CallingContextTrie& operator=(CallingContextTrie&&) = default;
+
+    NodeId add_root()
+    {
+        return new_node();
+    }
+
+    NodeId find_or_insert_child(NodeId parent, Address ip)
+    {
+        Node* p = &node(parent);
+
+        if ((p->num_children + 1) * 4 > p->capacity * 3)
+        {
+            grow(*p);
+        }
+
+        auto mask = p->capacity - 1;
+        for (auto pos = hash(ip) & mask;; pos = (pos + 1) & mask)
+        {
+            auto& slot = p->children[pos];
+            if (slot.node == INVALID_NODE)
+            {
+                // new_node() may allocate a new node slab, but never moves existing nodes
+                slot.ip = ip.value();
+                slot.node = new_node();
+                p->num_children++;
+                return slot.node;
+            }
+            if (slot.ip == ip.value())
+            {
+                return slot.node;
+            }
+        }
+    }
+
+    // Calls f(Address ip, NodeId child) for every child of parent, in no particular order.
+    template <class F>
+    void for_each_child(NodeId parent, F&& f) const
+    {
+        const Node& p = node(parent);
+        for (uint32_t i = 0; i < p.capacity; i++)
+        {
+            if (p.children[i].node != INVALID_NODE)
+            {
+                f(Address(p.children[i].ip), p.children[i].node);
+            }
+        }
+    }
+
+    // Number of nodes in this trie
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    // First id that is not handed out by this trie, i.e. the number of local references
+    NodeId next_id() const
+    {
+        return first_id_ + size_;
+    }
+
+    // Releases all nodes at once. Previously handed out node ids become invalid, new ones continue
+    // after them.
+    void clear()
+    {
+        node_slabs_.clear();
+        table_slabs_.clear();
+        table_free_ = nullptr;
+        table_left_ = 0;
+        first_id_ = next_id();
+        size_ = 0;
+    }
+
+private:
+    struct Slot
+    {
+        uint64_t ip;
+        NodeId node;
+    };
+
+    struct Node
+    {
+        Slot* children = nullptr;
+        uint32_t num_children = 0;
+        uint32_t capacity = 0;
+    };
+
+    static constexpr std::size_t NODE_SLAB_BITS = 12;
+    static constexpr std::size_t NODES_PER_SLAB = 1 << NODE_SLAB_BITS;
+    static constexpr std::size_t SLOTS_PER_SLAB = 1 << 14;
+
+    static uint64_t hash(Address ip)
+    {
+        // Fibonacci hashing, instruction pointers are mostly aligned and clustered
+        return (ip.value() * 0x9e3779b97f4a7c15ull) >> 32;
+    }
+
+    Node& node(NodeId id)
+    {
+        assert(id >= first_id_ && id - first_id_ < size_);
+        id -= first_id_;
+        return node_slabs_[id >> NODE_SLAB_BITS][id & (NODES_PER_SLAB - 1)];
+    }
+
+    const Node& node(NodeId id) const
+    {
+        assert(id >= first_id_ && id - first_id_ < size_);
+        id -= first_id_;
+        return node_slabs_[id >> NODE_SLAB_BITS][id & (NODES_PER_SLAB - 1)];
+    }
+
+    NodeId new_node()
+    {
+        assert(next_id() < INVALID_NODE);
+        if ((size_ & (NODES_PER_SLAB - 1)) == 0)
+        {
+            node_slabs_.emplace_back(std::make_unique<Node[]>(NODES_PER_SLAB));
+        }
+        return first_id_ + size_++;
+    }
+
+    Slot* allocate_table(uint32_t capacity)
+    {
+        Slot* table;
+        if (capacity > SLOTS_PER_SLAB)
+        {
+            // Huge fan-outs, e.g. the thread roots without call graph recording, get their own slab
+            table_slabs_.emplace_back(std::make_unique<Slot[]>(capacity));
+            table = table_slabs_.back().get();
+        }
+        else
+        {
+            if (capacity > table_left_)
+            {
+                table_slabs_.emplace_back(std::make_unique<Slot[]>(SLOTS_PER_SLAB));
+                table_free_ = table_slabs_.back().get();
+                table_left_ = SLOTS_PER_SLAB;
+            }
+            table = table_free_;
+            table_free_ += capacity;
+            table_left_ -= capacity;
+        }
+        std::fill_n(table, capacity, Slot{ 0, INVALID_NODE });
+        return table;
+    }
+
+    // The old table is not returned to the slabs. As tables only ever double, at most half of the
+    // table memory is wasted this way.
+    void grow(Node& n)
+    {
+        uint32_t capacity = n.capacity == 0 ? 2 : n.capacity * 2;
+        Slot* table = allocate_table(capacity);
+
+        for (uint32_t i = 0; i < n.capacity; i++)
+        {
+            const auto& slot = n.children[i];
+            if (slot.node == INVALID_NODE)
+            {
+                continue;
+            }
+            auto mask = capacity - 1;
+            auto pos = hash(slot.ip) & mask;
+            while (table[pos].node != INVALID_NODE)
+            {
+                pos = (pos + 1) & mask;
+            }
+            table[pos] = slot;
+        }
+
+        n.children = table;
+        n.capacity = capacity;
+    }
+
+    std::vector<std::unique_ptr<Node[]>> node_slabs_;
+    std::vector<std::unique_ptr<Slot[]>> table_slabs_;
+    Slot* table_free_ = nullptr;
+    std::size_t table_left_ = 0;
+    NodeId first_id_;
+    std::size_t size_ = 0;
+};
+} // namespace trace
+} // namespace lo2s
@@ -0,0 +1,76 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <lo2s/address.hpp>
+#include <lo2s/mmap.hpp>
+#include <lo2s/process_info.hpp>
+#include <lo2s/trace/stack_spill.hpp>
+#include <lo2s/types.hpp>
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+namespace lo2s
+{
+namespace trace
+{
+
+// Unwound frames of the spilled stacks of one sample writer, innermost first, keyed by stack id
+using UnwoundStacks = std::unordered_map<uint64_t, std::vector<Address>>;
+
+/*
+ * Unwinds the user stacks recorded with --call-graph-dwarf using libdw and the call frame
+ * information of the binaries in the memory maps of the sampled processes.
+ *
+ * libdw state is kept per process. Each process is only handled by a single worker at a time, so
+ * all processes of a chunk are unwound in parallel.
+ */
+class DwarfUnwinder
+{
+public:
+    DwarfUnwinder(const ProcessMaps& maps);
+    ~DwarfUnwinder();
+
+    DwarfUnwinder(const DwarfUnwinder&) = delete;
+    DwarfUnwinder& operator=(const DwarfUnwinder&) = delete;
+
+    void unwind(const std::vector<char>& chunk, UnwoundStacks& unwound);
+
+    // Upper limit of frames per stack, like the default of kernel.perf_event_max_stack
+    static constexpr std::size_t MAX_FRAMES = 127;
+
+private:
+    class ProcessState;
+
+    ProcessState& state(Process process);
+
+    const ProcessMaps& maps_;
+    std::map<Process, std::unique_ptr<ProcessState>> states_;
+};
+} // namespace trace
+} // namespace lo2s
@@ -0,0 +1,131 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <lo2s/address.hpp>
+#include <lo2s/line_info.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lo2s
+{
+namespace trace
+{
+
+/*
+ * Kernel portions of callchains, shared by all sample writers.
+ *
+ * In system-wide mode, every writer sees the same few kernel paths (syscall entry, scheduler, page
+ * faults). Instead of building subtrees for them in every writer-local calling context trie, the
+ * kernel frames of a callchain are interned here once and the trie only holds a single node for
+ * the whole kernel stack, keyed by tag(id). Lookups only take a shared lock, so that writers
+ * rarely contend after the common stacks have been seen.
+ */
+class KernelStackTable
+{
+public:
+    using StackId = uint32_t;
+
+    // Frames are stored in perf order, innermost first
+    using Frames = std::vector<uint64_t>;
+
+    KernelStackTable() = default;
+    KernelStackTable(const KernelStackTable&) = delete;
+    KernelStackTable& operator=(const KernelStackTable&) = delete;
+
+    StackId intern(const uint64_t* frames, std::size_t nr);
+
+    const Frames& frames(StackId id) const;
+
+    // Resolved on first use, in the same order as frames(id)
+    const std::vector<LineInfo>& line_infos(StackId id);
+
+    // Tagged values are non-canonical addresses, which can neither be user space nor kernel ips
+    static uint64_t tag(StackId id)
+    {
+        return TAG | id;
+    }
+
+    static bool is_tag(Address ip)
+    {
+        return (ip.value() & TAG_MASK) == TAG;
+    }
+
+    static StackId id(Address ip)
+    {
+        return static_cast<StackId>(ip.value() & ~TAG_MASK);
+    }
+
+    std::size_t size() const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return stacks_.size();
+    }
+
+private:
+    static constexpr uint64_t TAG = 0x8000'0000'0000'0000ull;
+    static constexpr uint64_t TAG_MASK = 0xffff'ffff'0000'0000ull;
+
+    struct FramesHash
+    {
+        std::size_t operator()(const Frames& frames) const
+        {
+            constexpr uint64_t k = 0x9e3779b97f4a7c15ull;
+
+            uint64_t hash = frames.size() * k;
+            for (auto frame : frames)
+            {
+                hash = (hash ^ frame) * k;
+                hash ^= hash >> 29;
+            }
+            return hash;
+        }
+    };
+
+    LineInfo resolve(uint64_t ip);
+    void read_kallsyms();
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<Frames, StackId, FramesHash> ids_;
+    // Points to the keys of ids_, which stay in place on rehashing
+    std::vector<const Frames*> stacks_;
+
+    // Only used by the merging thread
+    std::mutex resolve_mutex_;
+    std::unordered_map<StackId, std::vector<LineInfo>> line_infos_;
+    std::unordered_map<uint64_t, LineInfo> resolved_ips_;
+    bool kallsyms_read_ = false;
+    // start address to symbol name and module
+    std::map<uint64_t, std::pair<std::string, std::string>> kallsyms_;
+};
+} // namespace trace
+} // namespace lo2s
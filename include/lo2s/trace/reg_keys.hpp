@@ -23,7 +23,6 @@
 #pragma once
 #include <lo2s/address.hpp>
 #include <lo2s/execution_scope.hpp>
-#include <lo2s/line_info.hpp>
 #include <lo2s/measurement_scope.hpp>
 #include <lo2s/perf/bio/block_device.hpp>
 #include <lo2s/perf/counter/counter_collection.hpp>
@@ -103,11 +102,6 @@ struct ByAddressTag
 };
 using ByAddress = SimpleKeyType<Address, ByAddressTag>;
 
-struct ByLineInfoTag
-{
-};
-using ByLineInfo = SimpleKeyType<LineInfo, ByLineInfoTag>;
-
 struct ByExecutionScopeTag
 {
 };
@@ -190,8 +184,7 @@ struct Holder<otf2::definition::location>
 template <>
 struct Holder<otf2::definition::region>
 {
-    using type =
-        otf2::lookup_definition_holder<otf2::definition::region, ByThread, ByLineInfo, BySyscall>;
+    using type = otf2::lookup_definition_holder<otf2::definition::region, ByThread, BySyscall>;
 };
 template <>
 struct Holder<otf2::definition::calling_context>
@@ -202,8 +195,8 @@ struct Holder<otf2::definition::calling_context>
 template <>
 struct Holder<otf2::definition::source_code_location>
 {
-    using type = otf2::lookup_definition_holder<otf2::definition::source_code_location, ByLineInfo,
-                                                BySyscall>;
+    using type =
+        otf2::lookup_definition_holder<otf2::definition::source_code_location, BySyscall>;
 };
 template <>
 struct Holder<otf2::definition::comm>
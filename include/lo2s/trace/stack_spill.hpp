@@ -0,0 +1,139 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <lo2s/address.hpp>
+#include <lo2s/types.hpp>
+
+#include <filesystem>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lo2s
+{
+namespace trace
+{
+
+// A user stack as it has been read back from the spill file. Points into the chunk it was read
+// with.
+struct SpilledStack
+{
+    uint64_t id;
+    Process process;
+    const uint64_t* regs;
+    std::size_t num_regs;
+    const char* data;
+    uint64_t size;
+};
+
+/*
+ * Temporary file for the user stacks of a sample writer, see --call-graph-dwarf.
+ *
+ * The writer only copies the registers and the stack dump of every sample into a buffer, which is
+ * written out in large blocks, so that unwinding stays off the monitoring threads. The calling
+ * context of the sample is a placeholder node keyed by tag(id) until the stack has been unwound.
+ * The file is unlinked right after it has been created and vanishes with the last descriptor.
+ */
+class StackSpill
+{
+public:
+    StackSpill(const std::filesystem::path& path);
+    ~StackSpill();
+
+    StackSpill(const StackSpill&) = delete;
+    StackSpill& operator=(const StackSpill&) = delete;
+
+    // Returns the id of the stack, ids are consecutive
+    uint64_t append(Process process, const uint64_t* regs, std::size_t num_regs, const char* data,
+                    uint64_t size);
+
+    // Writes out all appended stacks, returns the end of the written data
+    uint64_t flush();
+
+    // Reads whole records from pos until end or until roughly max_bytes have been read and
+    // advances pos behind them
+    std::vector<char> read(uint64_t& pos, uint64_t end, std::size_t max_bytes) const;
+
+    template <typename F>
+    static void for_each(const std::vector<char>& chunk, F&& f)
+    {
+        for (std::size_t pos = 0; pos < chunk.size();)
+        {
+            const auto* header = reinterpret_cast<const RecordHeader*>(chunk.data() + pos);
+            const auto* regs = reinterpret_cast<const uint64_t*>(header + 1);
+            const auto* data = reinterpret_cast<const char*>(regs + header->num_regs);
+
+            f(SpilledStack{ header->id, Process(header->pid), regs, header->num_regs, data,
+                            header->size });
+
+            pos += record_size(header->num_regs, header->size);
+        }
+    }
+
+    // Tagged values are non-canonical addresses, which can neither be user space nor kernel ips
+    static uint64_t tag(uint64_t id)
+    {
+        return TAG | id;
+    }
+
+    static bool is_tag(Address ip)
+    {
+        return (ip.value() & TAG_MASK) == TAG;
+    }
+
+    static uint64_t id(Address ip)
+    {
+        return ip.value() & ~TAG_MASK;
+    }
+
+private:
+    static constexpr uint64_t TAG = 0x8001'0000'0000'0000ull;
+    static constexpr uint64_t TAG_MASK = 0xffff'0000'0000'0000ull;
+
+    static constexpr std::size_t BUFFER_SIZE = 1024 * 1024;
+
+    struct RecordHeader
+    {
+        uint64_t id;
+        int64_t pid;
+        uint64_t num_regs;
+        uint64_t size;
+    };
+
+    // Records are padded to keep them 8-byte aligned
+    static std::size_t record_size(uint64_t num_regs, uint64_t size)
+    {
+        return sizeof(RecordHeader) + num_regs * sizeof(uint64_t) + ((size + 7) & ~uint64_t(7));
+    }
+
+    void write_buffer();
+
+    int fd_;
+    std::vector<char> buffer_;
+    uint64_t written_ = 0;
+    uint64_t next_id_ = 0;
+};
+} // namespace trace
+} // namespace lo2s
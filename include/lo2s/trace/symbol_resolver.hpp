@@ -0,0 +1,88 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <lo2s/address.hpp>
+#include <lo2s/line_info.hpp>
+#include <lo2s/mmap.hpp>
+#include <lo2s/process_info.hpp>
+#include <lo2s/types.hpp>
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace lo2s
+{
+namespace trace
+{
+
+/*
+ * Resolves the instruction pointers of calling contexts in bulk.
+ *
+ * All ips are collected first and grouped by the binary they belong to. resolve() then looks them
+ * up on a pool of worker threads, each binary by a single worker. Symbol index lookups run in
+ * parallel, while everything that touches BFD (--line-info) is serialized by bfdr::bfd_mutex().
+ * Afterwards, the results can be read cheaply while the calling context definitions are created.
+ *
+ * With --defer-symbols, ips in files are not looked up at all. They resolve to a placeholder and
+ * deferred() tells the binary and offset to hand to lo2s-symbolize.
+ */
+class SymbolResolver
+{
+public:
+    SymbolResolver(const ProcessMaps& maps);
+
+    void add(Process process, Address ip);
+
+    void resolve();
+
+    LineInfo line_info(Process process, Address ip) const;
+
+    // Only available with --disassemble, returns nullptr if the instruction could not be read.
+    const std::string* instruction(Process process, Address ip) const;
+
+    // Only available with --defer-symbols, the binary and offset of an ip that was not resolved
+    std::optional<std::pair<const Binary*, Address>> deferred(Process process, Address ip) const;
+
+private:
+    struct Resolved
+    {
+        LineInfo line_info = LineInfo::for_unknown_function();
+        std::optional<std::string> instruction;
+        bool deferred = false;
+    };
+
+    // Keyed by the address within the binary
+    using BinaryIps = std::unordered_map<uint64_t, Resolved>;
+
+    const Resolved* find(Process process, Address ip) const;
+
+    const ProcessMaps& maps_;
+    std::unordered_map<Binary*, BinaryIps> binaries_;
+};
+} // namespace trace
+} // namespace lo2s
@@ -28,7 +28,12 @@
 #include <lo2s/perf/counter/counter_collection.hpp>
 #include <lo2s/perf/counter/counter_provider.hpp>
 #include <lo2s/process_info.hpp>
+#include <lo2s/trace/calling_context_trie.hpp>
+#include <lo2s/trace/dwarf_unwinder.hpp>
+#include <lo2s/trace/kernel_stack_table.hpp>
 #include <lo2s/trace/reg_keys.hpp>
+#include <lo2s/trace/stack_spill.hpp>
+#include <lo2s/trace/symbol_resolver.hpp>
 #include <lo2s/types.hpp>
 
 #include <otf2xx/otf2.hpp>
@@ -36,8 +41,10 @@
 #include <atomic>
 #include <deque>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
+#include <shared_mutex>
 #include <unordered_map>
 
 namespace lo2s
@@ -49,24 +56,14 @@ class MainMonitor;
 template <typename RefMap>
 using IpMap = std::map<Address, RefMap>;
 
-struct IpRefEntry
-{
-    IpRefEntry(otf2::definition::calling_context::reference_type r) : ref(r)
-    {
-    }
-
-    otf2::definition::calling_context::reference_type ref;
-    IpMap<IpRefEntry> children;
-};
-
 struct ThreadCctxRefs
 {
-    ThreadCctxRefs(Process p, otf2::definition::calling_context::reference_type r)
-    : process(p), entry(r)
+    ThreadCctxRefs(Process p, CallingContextTrie::NodeId r) : process(p), root(r)
     {
     }
     Process process;
-    IpRefEntry entry;
+    // Node ids of the trie are the writer-local calling context references
+    CallingContextTrie::NodeId root;
 };
 
 struct IpCctxEntry
@@ -79,22 +76,45 @@ struct IpCctxEntry
     IpMap<IpCctxEntry> children;
 };
 
+/*
+ * Part of the calling context tree of a sample writer that has been handed off for merging while
+ * the writer continues with a fresh trie.
+ */
+struct CctxDelta
+{
+    std::map<Thread, ThreadCctxRefs> map;
+    CallingContextTrie trie;
+    // End of the spilled stacks that belong to this delta, see --call-graph-dwarf
+    uint64_t spill_end = 0;
+};
+
 /*
  * Stores calling context information for each sample writer / monitoring thread.
  * While the `Trace` always owns this data, the `sample::Writer` should have exclusive access to
- * this data during its lifetime. Only afterwards, the `writer` and `refcount` are set by the
- * `sample::Writer`.
+ * `map` and `trie` during its lifetime. Only afterwards, the `writer` and `refcount` are set by the
+ * `sample::Writer`. Deltas handed off in between are guarded by `pending_mutex`, `mappings` is only
+ * accessed by the merging thread.
  */
 struct ThreadCctxRefMap
 {
     std::map<Thread, ThreadCctxRefs> map;
+    CallingContextTrie trie;
     std::atomic<otf2::writer::local*> writer = nullptr;
     std::atomic<size_t> ref_count;
 
+    std::mutex pending_mutex;
+    std::vector<CctxDelta> pending;
+    // global calling context reference for every local reference that has been merged so far
+    std::vector<uint32_t> mappings;
+
+    // With --call-graph-dwarf, the user stacks of the samples. Stacks up to spill_read have
+    // already been unwound and merged.
+    std::unique_ptr<StackSpill> spill;
+    uint64_t spill_read = 0;
+
     using value_type = std::map<Thread, ThreadCctxRefs>::value_type;
 };
 
-using IpRefMap = IpMap<IpRefEntry>;
 using IpCctxMap = IpMap<IpCctxEntry>;
 
 class Trace
@@ -121,10 +141,16 @@ public:
     void update_thread_name(Thread t, const std::string& name);
 
     ThreadCctxRefMap& create_cctx_refs();
-    otf2::definition::mapping_table
-    merge_calling_contexts(const std::map<Thread, ThreadCctxRefs>& new_ips, size_t num_ip_refs,
-                           const std::map<Process, ProcessInfo>& infos);
-    void merge_calling_contexts(const std::map<Process, ProcessInfo>& process_infos);
+
+    KernelStackTable& kernel_stacks()
+    {
+        return kernel_stacks_;
+    }
+
+    // Merges the deltas that the sample writers have handed off so far. Can be called while
+    // recording.
+    void merge_pending_calling_contexts(const ProcessMaps& process_maps);
+    void merge_calling_contexts(const ProcessMaps& process_maps);
 
     otf2::definition::mapping_table merge_syscall_contexts(const std::set<int64_t>& used_syscalls);
 
@@ -168,6 +194,49 @@ public:
         return cpuid_metric_class_;
     }
 
+    // Number of samples that a calling context sample stands for, see --profile-window
+    otf2::definition::metric_class profile_metric_class()
+    {
+        if (!profile_metric_class_)
+        {
+            profile_metric_class_ = registry_.create<otf2::definition::metric_class>(
+                otf2::common::metric_occurence::async, otf2::common::recorder_kind::abstract);
+            profile_metric_class_->add_member(metric_member(
+                "samples", "Number of samples of the calling context in the last window",
+                otf2::common::metric_mode::absolute_point, otf2::common::type::int64, "#"));
+        }
+        return profile_metric_class_;
+    }
+
+    // Overhead of lo2s, see --self-metrics. Every event describes one read() or wakeup.
+    otf2::definition::metric_class self_metric_class()
+    {
+        if (!self_metric_class_)
+        {
+            self_metric_class_ = registry_.create<otf2::definition::metric_class>(
+                otf2::common::metric_occurence::async, otf2::common::recorder_kind::abstract);
+            self_metric_class_->add_member(metric_member(
+                "lo2s::records", "perf records read", otf2::common::metric_mode::absolute_last,
+                otf2::common::type::int64, "#"));
+            self_metric_class_->add_member(metric_member(
+                "lo2s::bytes", "perf data read", otf2::common::metric_mode::absolute_last,
+                otf2::common::type::int64, "B"));
+            self_metric_class_->add_member(metric_member(
+                "lo2s::fill", "perf buffer fill level on wakeup",
+                otf2::common::metric_mode::absolute_point, otf2::common::type::int64, "%"));
+            self_metric_class_->add_member(metric_member(
+                "lo2s::time", "time spent reading", otf2::common::metric_mode::absolute_last,
+                otf2::common::type::int64, "ns"));
+            self_metric_class_->add_member(metric_member(
+                "lo2s::lost", "perf records lost", otf2::common::metric_mode::absolute_last,
+                otf2::common::type::int64, "#"));
+            self_metric_class_->add_member(metric_member(
+                "lo2s::throttled", "perf throttle events", otf2::common::metric_mode::absolute_last,
+                otf2::common::type::int64, "#"));
+        }
+        return self_metric_class_;
+    }
+
     otf2::definition::metric_member& get_event_metric_member(perf::EventDescription event)
     {
         return registry_.emplace<otf2::definition::metric_member>(
@@ -287,9 +356,36 @@ private:
     void add_thread_exclusive(Thread thread, const std::string& name,
                               const std::lock_guard<std::recursive_mutex>&);
 
-    void merge_ips(const IpRefMap& new_children, IpCctxMap& children,
-                   std::vector<uint32_t>& mapping_table, otf2::definition::calling_context& parent,
-                   const std::map<Process, ProcessInfo>& infos, Process p);
+    // Adds the ips below local_parent that are not yet in the global tree to the resolver
+    void collect_ips(const CallingContextTrie& trie, CallingContextTrie::NodeId local_parent,
+                     const IpCctxMap* children, SymbolResolver& resolver, Process p,
+                     const UnwoundStacks& unwound);
+
+    void merge_ips(const CallingContextTrie& trie, CallingContextTrie::NodeId local_parent,
+                   IpCctxMap& children, std::vector<uint32_t>& mapping_table,
+                   otf2::definition::calling_context& parent, const SymbolResolver& resolver,
+                   Process p, const UnwoundStacks& unwound);
+
+    IpCctxEntry& find_or_create_cctx(IpCctxMap& children, Address ip,
+                                     otf2::definition::calling_context& parent,
+                                     const SymbolResolver& resolver, Process p);
+
+    // Expands an interned kernel stack below parent, returns the innermost frame
+    otf2::definition::calling_context& merge_kernel_stack(IpCctxMap& children,
+                                                          otf2::definition::calling_context& parent,
+                                                          KernelStackTable::StackId id);
+
+    void merge_calling_contexts(const std::map<Thread, ThreadCctxRefs>& new_ips,
+                                const CallingContextTrie& trie, std::vector<uint32_t>& mappings,
+                                const SymbolResolver& resolver, const UnwoundStacks& unwound);
+
+    // Writes the placeholders of --defer-symbols to lo2s-symbols.txt for lo2s-symbolize
+    void write_deferred_symbols();
+
+    // Unwinds the stacks that have been spilled by the writer up to the end of its last delta
+    void unwind_stacks(ThreadCctxRefMap& cctx, uint64_t spill_end,
+                       const ProcessMaps& process_maps,
+                       UnwoundStacks& unwound);
 
     const otf2::definition::system_tree_node bio_parent_node(BlockDevice& device)
     {
@@ -347,6 +443,22 @@ public:
     
 private:
     std::map<Thread, IpCctxEntry> calling_context_tree_;
+    KernelStackTable kernel_stacks_;
+
+    // Regions and source code locations of resolved instructions. Known ones are looked up under
+    // a shared lock only, new ones are created with #mutex_ held.
+    std::shared_mutex line_info_mutex_;
+    std::unordered_map<LineInfo, otf2::definition::region> line_info_regions_;
+    std::unordered_map<LineInfo, otf2::definition::source_code_location> line_info_scls_;
+
+    struct DeferredSymbol
+    {
+        uint32_t scl;
+        const Binary* binary;
+        Address offset;
+    };
+    // Placeholder regions of --defer-symbols by their reference
+    std::map<uint32_t, DeferredSymbol> deferred_symbols_;
 
     otf2::definition::comm_locations_group& comm_locations_group_;
     otf2::definition::comm_locations_group& hardware_comm_locations_group_;
@@ -354,6 +466,8 @@ private:
     otf2::definition::regions_group& syscall_regions_group_;
 
     otf2::definition::detail::weak_ref<otf2::definition::metric_class> cpuid_metric_class_;
+    otf2::definition::detail::weak_ref<otf2::definition::metric_class> self_metric_class_;
+    otf2::definition::detail::weak_ref<otf2::definition::metric_class> profile_metric_class_;
     std::map<std::set<Cpu>, otf2::definition::detail::weak_ref<otf2::definition::metric_class>>
         perf_group_metric_classes_;
     std::map<std::set<Cpu>, otf2::definition::detail::weak_ref<otf2::definition::metric_class>>
@@ -0,0 +1,91 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/build_config.hpp>
+#include <lo2s/log.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <cstdint>
+#include <cstdlib>
+
+/*
+ * Cost of a filtered debug/trace log statement on a per-record path, i.e. in a run without -v.
+ *
+ * Compares a loop without logging, LO2S_HOT_LOG(trace) and a plain Log::trace(). Configure with
+ * -DUSE_HOT_PATH_LOGGING=OFF to see that LO2S_HOT_LOG costs nothing when it is compiled out.
+ *
+ *     lo2s-bench-hot-log [ITERATIONS]
+ */
+
+namespace
+{
+volatile uint64_t sink = 0;
+
+template <class F>
+double ns_per_op(uint64_t iterations, F&& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        f(i);
+    }
+    std::chrono::duration<double, std::nano> duration = std::chrono::steady_clock::now() - start;
+    return duration.count() / iterations;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    uint64_t iterations = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    if (iterations == 0)
+    {
+        std::cerr << "usage: " << argv[0] << " [ITERATIONS]\n";
+        return EXIT_FAILURE;
+    }
+
+    lo2s::logging::set_min_severity_level(nitro::log::severity_level::info);
+    const std::string dso = "/usr/lib/libc.so.6";
+
+    auto none = ns_per_op(iterations, [&](uint64_t i) { sink = sink + i; });
+    auto hot = ns_per_op(iterations, [&](uint64_t i) {
+        sink = sink + i;
+        LO2S_HOT_LOG(trace) << "resolved " << i << " in " << dso;
+    });
+    auto plain = ns_per_op(iterations, [&](uint64_t i) {
+        sink = sink + i;
+        lo2s::Log::trace() << "resolved " << i << " in " << dso;
+    });
+
+#ifdef USE_HOT_PATH_LOGGING
+    std::cout << "LO2S_HOT_LOG compiled in, " << iterations << " iterations\n";
+#else
+    std::cout << "LO2S_HOT_LOG compiled out, " << iterations << " iterations\n";
+#endif
+    std::cout << "no logging:    " << none << " ns/op\n";
+    std::cout << "LO2S_HOT_LOG:  " << hot << " ns/op\n";
+    std::cout << "Log::trace():  " << plain << " ns/op\n";
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,179 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/address.hpp>
+#include <lo2s/bfd_resolve.hpp>
+#include <lo2s/config.hpp>
+#include <lo2s/elf_resolve.hpp>
+#include <lo2s/line_info.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
+
+/*
+ * Compares function name lookups of the native ELF symbol index (elfr::Lib) with BFD (bfdr::Lib)
+ * for one binary: the time to load each, the time per lookup and whether both agree on the
+ * function names. Lookups go to the middle of evenly spread function symbols.
+ *
+ *     lo2s-bench-symbols BINARY [LOOKUPS]
+ */
+
+namespace lo2s
+{
+// Defaults only, in particular no symbol cache, so that the ELF index is always built
+const Config& config()
+{
+    static Config instance;
+    return instance;
+}
+} // namespace lo2s
+
+namespace
+{
+volatile std::size_t sink = 0;
+
+using Clock = std::chrono::steady_clock;
+
+double ms_since(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+double ns_since(Clock::time_point start, uint64_t ops)
+{
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ops;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " BINARY [LOOKUPS]\n";
+        return EXIT_FAILURE;
+    }
+    const std::string binary = argv[1];
+    const uint64_t lookups = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 100000;
+
+    std::unique_ptr<lo2s::elfr::Lib> elf;
+    std::unique_ptr<lo2s::bfdr::Lib> bfd;
+
+    auto start = Clock::now();
+    try
+    {
+        elf = std::make_unique<lo2s::elfr::Lib>(binary);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "could not index " << binary << ": " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+    auto elf_load = ms_since(start);
+
+    start = Clock::now();
+    try
+    {
+        bfd = std::make_unique<lo2s::bfdr::Lib>(binary);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "could not open " << binary << " with BFD: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+    auto bfd_load = ms_since(start);
+
+    if (elf->size() == 0 || lookups == 0)
+    {
+        std::cerr << "nothing to look up in " << binary << '\n';
+        return EXIT_FAILURE;
+    }
+
+    std::vector<lo2s::Address> addresses;
+    const std::size_t stride = std::max<std::size_t>(1, elf->size() / 4096);
+    for (std::size_t i = 0; i < elf->size(); i += stride)
+    {
+        const auto& symbol = elf->symbol(i);
+        addresses.emplace_back(symbol.start + (symbol.end - symbol.start) / 2);
+    }
+
+    uint64_t elf_misses = 0;
+    start = Clock::now();
+    for (uint64_t i = 0; i < lookups; i++)
+    {
+        try
+        {
+            sink = sink + elf->lookup(addresses[i % addresses.size()]).size();
+        }
+        catch (lo2s::elfr::LookupError&)
+        {
+            elf_misses++;
+        }
+    }
+    auto elf_lookup = ns_since(start, lookups);
+
+    uint64_t bfd_misses = 0;
+    start = Clock::now();
+    for (uint64_t i = 0; i < lookups; i++)
+    {
+        try
+        {
+            sink = sink + bfd->lookup(addresses[i % addresses.size()]).line();
+        }
+        catch (lo2s::bfdr::LookupError&)
+        {
+            bfd_misses++;
+        }
+    }
+    auto bfd_lookup = ns_since(start, lookups);
+
+    std::size_t agree = 0;
+    for (auto address : addresses)
+    {
+        try
+        {
+            if (elf->lookup(address) == bfd->lookup(address).function())
+            {
+                agree++;
+            }
+        }
+        catch (std::runtime_error&)
+        {
+        }
+    }
+
+    std::cout << binary << ": " << elf->size() << " function symbols, " << addresses.size()
+              << " sampled addresses, " << lookups << " lookups\n";
+    std::cout << "load:    elf " << elf_load << " ms, bfd " << bfd_load << " ms\n";
+    std::cout << "lookup:  elf " << elf_lookup << " ns/op (" << elf_misses << " misses), bfd "
+              << bfd_lookup << " ns/op (" << bfd_misses << " misses)\n";
+    std::cout << "names:   " << agree << " of " << addresses.size() << " agree\n";
+
+    return EXIT_SUCCESS;
+}
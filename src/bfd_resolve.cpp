@@ -64,9 +64,13 @@ static void dummy_bfd_error_handler(const char*, [[maybe_unused]] va_list argp)
     return;
 }
 
-Lib::Lib(const std::string& name)
-: name_(name), handle_(bfd_openr(check_path(name).c_str(), nullptr))
+Lib::Lib(const std::string& name, bool function_names) : name_(name)
 {
+    auto path = check_path(name);
+
+    // Released before handle_ is closed if we throw
+    std::lock_guard<std::mutex> lock(bfd_mutex());
+    handle_.reset(bfd_openr(path.c_str(), nullptr));
     if (!handle_)
     {
         throw InitError("failed to open BFD handle", name);
@@ -94,8 +98,15 @@ Lib::Lib(const std::string& name)
     //                throw std::runtime_error("BFD flavor not ELF.");
     //            }
 
-    read_symbols();
-    read_sections();
+    if (function_names)
+    {
+        read_symbols();
+        read_sections();
+    }
+    else
+    {
+        read_code_sections();
+    }
 }
 
 LineInfo Lib::lookup(Address addr) const
@@ -104,6 +115,7 @@ LineInfo Lib::lookup(Address addr) const
     const char* func = nullptr;
     unsigned int line = 0;
 
+    std::lock_guard<std::mutex> lock(bfd_mutex());
     try
     {
         auto section = sections_.at(addr);
@@ -122,7 +134,9 @@ LineInfo Lib::lookup(Address addr) const
                          << base << ", size: " << hex << size;
             throw LookupError("address out of .symtab bounds", addr);
         }
-        auto evil_symtab = const_cast<asymbol**>(symbols_.data());
+        // Without a symbol table, BFD still finds lines and functions in the debug information
+        auto evil_symtab =
+            symbols_.empty() ? nullptr : const_cast<asymbol**>(symbols_.data());
         auto found = bfd_find_nearest_line(handle_.get(), section, evil_symtab, local_addr.value(),
                                            &file, &func, &line);
         if (!found)
@@ -207,34 +221,55 @@ void Lib::read_sections()
         {
             continue;
         }
-        // VMA is useless for shared libraries, we remove the offset from the map
-        // so use filepos instead
-        // auto start = bfd_get_section_vma(handle_, section);
-        auto start = section->filepos;
-        auto size = bfd_get_section_size(section);
-        if (size == 0)
-        {
-            Log::debug() << "skipping empty section: "
-                         << bfd_get_section_name(handle_.get(), section);
-            continue;
-        }
-        try
-        {
-            auto r = sections_.emplace(std::piecewise_construct,
-                                       std::forward_as_tuple(start, start + size),
-                                       std::forward_as_tuple(section));
-            if (r.second)
+        add_section(section);
+    }
+}
+
+void Lib::read_code_sections()
+{
+    // Without symbols, fall back to the sections that contain code, which do not overlap either
+    bfd_map_over_sections(
+        handle_.get(),
+        [](bfd*, asection* section, void* lib) {
+            if (section->flags & SEC_CODE)
             {
-                Log::trace() << "Added section: " << bfd_get_section_name(handle_.get(), section)
-                             << " from symbol " << sym->name;
+                static_cast<Lib*>(lib)->add_section(section);
             }
-        }
-        catch (Range::Error& e)
+        },
+        this);
+    if (sections_.empty())
+    {
+        throw InitError("could not find any code sections", name_);
+    }
+}
+
+void Lib::add_section(asection* section)
+{
+    // VMA is useless for shared libraries, we remove the offset from the map
+    // so use filepos instead
+    // auto start = bfd_get_section_vma(handle_, section);
+    auto start = section->filepos;
+    auto size = bfd_get_section_size(section);
+    if (size == 0)
+    {
+        Log::debug() << "skipping empty section: " << bfd_get_section_name(handle_.get(), section);
+        return;
+    }
+    try
+    {
+        auto r =
+            sections_.emplace(std::piecewise_construct, std::forward_as_tuple(start, start + size),
+                              std::forward_as_tuple(section));
+        if (r.second)
         {
-            Log::warn() << "failed to add section " << bfd_get_section_name(handle_.get(), section)
-                        << "due to " << e.what();
+            Log::trace() << "Added section: " << bfd_get_section_name(handle_.get(), section);
         }
     }
+    catch (Range::Error& e)
+    {
+        Log::warn() << "failed to add section " << bfd_get_section_name(handle_.get(), section)
+                    << "due to " << e.what();
+    }
 }
 } // namespace bfdr
 } // namespace lo2s
@@ -189,6 +189,31 @@ void parse_program_options(int argc, const char** argv)
         .default_value("16")
         .metavar("PAGES");
 
+    general_options
+        .toggle("adaptive-buffers",
+                "Grow perf buffers that overflow and shrink them again when they stay mostly "
+                "empty. --mmap-pages is used as the initial and minimal size.")
+        .allow_reverse();
+
+    general_options
+        .toggle("consolidate-buffers",
+                "Record all perf events of a CPU into a single buffer. Only in system-wide mode.")
+        .allow_reverse();
+
+    general_options
+        .option("mmap-budget", "Upper limit in KiB by which all perf buffers together may grow "
+                               "beyond --mmap-pages with --adaptive-buffers (default: "
+                               "perf_event_mlock_kb for every CPU).")
+        .metavar("KIB")
+        .optional();
+
+    general_options
+        .option("flight-recorder",
+                "Only keep the last SECONDS of perf data in overwritable buffers, which are "
+                "written to the trace on SIGUSR2 or SIGINT. Only in system-wide mode.")
+        .metavar("SECONDS")
+        .optional();
+
     general_options
         .option("readout-interval", "Time in milliseconds between readouts of interval based "
                                     "monitors, i.e. x86_adapt, x86_energy.")
@@ -204,6 +229,48 @@ void parse_program_options(int argc, const char** argv)
         .optional()
         .metavar("MSEC");
 
+    general_options.toggle("metric-suppress-unchanged",
+                           "Only write metric events of interval based monitors (nvml, sensors, "
+                           "x86_adapt) if their values changed.");
+
+    general_options
+        .option("metric-tolerance",
+                "Changes up to this absolute value count as unchanged with "
+                "--metric-suppress-unchanged.")
+        .default_value("0")
+        .metavar("VALUE");
+
+    general_options
+        .option("metric-heartbeat",
+                "With --metric-suppress-unchanged, write unchanged values anyway after N "
+                "suppressed events. 0 disables the heartbeat.")
+        .default_value("100")
+        .metavar("N");
+
+    general_options.toggle("cpuid-suppress-unchanged",
+                           "Only write the CPU metric of samples if the CPU changed.");
+
+    general_options
+        .option("cpuid-heartbeat",
+                "With --cpuid-suppress-unchanged, write the unchanged CPU anyway after N "
+                "suppressed events. 0 disables the heartbeat.")
+        .default_value("100")
+        .metavar("N");
+
+    general_options
+        .option("monitor-workers",
+                "Read the perf buffers of all monitored threads with N worker threads instead of "
+                "one monitoring thread per monitored thread. \"auto\" uses one worker per CPU.")
+        .optional()
+        .metavar("N");
+
+    general_options.toggle("self-metrics",
+                           "Record the overhead of lo2s itself as metrics and print a summary.");
+
+    general_options.toggle(
+        "inherit", "Monitor the process with one perf event per CPU that is inherited by new "
+                   "threads, instead of opening events for every thread.");
+
     general_options.option("clockid", "Reference clock used as timestamp source.")
         .short_name("k")
         .default_value("monotonic-raw")
@@ -253,6 +320,38 @@ void parse_program_options(int argc, const char** argv)
     sampling_options.toggle("call-graph", "Record call stack of instruction samples.")
         .short_name("g");
 
+    sampling_options.toggle("call-graph-dwarf",
+                            "Record call stacks of instruction samples by dumping the user stack "
+                            "and unwinding it with DWARF call frame information after recording. "
+                            "Works for binaries without frame pointers.");
+
+    sampling_options
+        .option("stack-dump-size",
+                "Number of bytes of the user stack that are recorded with --call-graph-dwarf.")
+        .default_value("8192")
+        .metavar("BYTES");
+
+    sampling_options
+        .option("merge-interval",
+                "Time in milliseconds of recording after which calling contexts are merged into "
+                "the trace in the background. If not provided, they are merged at the end.")
+        .optional()
+        .metavar("MSEC");
+
+    sampling_options
+        .option("profile-window",
+                "Instead of one event per sample, write the number of samples per calling "
+                "context for every window of MSEC milliseconds.")
+        .optional()
+        .metavar("MSEC");
+
+    sampling_options
+        .option("reorder-window",
+                "Number of samples and context switches that are buffered to restore their "
+                "timestamp order. 0 clamps out-of-order timestamps instead.")
+        .default_value("0")
+        .metavar("N");
+
     sampling_options.toggle("no-ip",
                             "Do not record instruction pointers [NOT CURRENTLY SUPPORTED]");
 
@@ -263,6 +362,30 @@ void parse_program_options(int argc, const char** argv)
 #endif
         .allow_reverse();
 
+    sampling_options
+        .toggle("line-info", "Resolve source files and line numbers of samples from debug "
+                             "information. Function names are always resolved from the symbol "
+                             "table.")
+        .default_value(true)
+        .allow_reverse();
+
+    sampling_options.toggle("defer-symbols",
+                            "Do not resolve symbols of sampled instructions. Only their binaries "
+                            "and offsets are stored in the trace, run lo2s-symbolize on it later.");
+
+    sampling_options
+        .option("symbol-cache", "Directory in which symbol indexes of sampled binaries are kept "
+                                "across runs, keyed by build-id.")
+        .env("LO2S_SYMBOL_CACHE")
+        .metavar("DIR")
+        .optional();
+
+    sampling_options
+        .option("symbol-cache-size", "Maximum size of the --symbol-cache directory in MiB. The "
+                                     "least recently used indexes are removed beyond that.")
+        .default_value("256")
+        .metavar("MIB");
+
     sampling_options.toggle("kernel", "Include events happening in kernel space.")
         .allow_reverse()
         .default_value(true);
@@ -354,12 +477,47 @@ void parse_program_options(int argc, const char** argv)
     config.trace_path = arguments.get("output-trace");
     config.quiet = arguments.given("quiet");
     config.mmap_pages = arguments.as<std::size_t>("mmap-pages");
+    config.adaptive_buffers = arguments.given("adaptive-buffers");
+    config.consolidate_buffers = arguments.given("consolidate-buffers");
+    config.self_metrics = arguments.given("self-metrics");
+    if (arguments.provided("mmap-budget"))
+    {
+        config.mmap_budget_pages =
+            arguments.as<std::size_t>("mmap-budget") * 1024 / get_page_size();
+    }
+    else
+    {
+        try
+        {
+            config.mmap_budget_pages =
+                get_sysctl<std::size_t>("kernel", "perf_event_mlock_kb") *
+                Topology::instance().cpus().size() * 1024 / get_page_size();
+        }
+        catch (const std::exception& e)
+        {
+            if (config.adaptive_buffers)
+            {
+                Log::warn() << "Could not read perf_event_mlock_kb, perf buffers will not grow "
+                               "unless --mmap-budget is given: "
+                            << e.what();
+            }
+            config.mmap_budget_pages = 0;
+        }
+    }
     config.process =
         arguments.provided("pid") ? Process(arguments.as<pid_t>("pid")) : Process::invalid();
     config.sampling_event = arguments.get("event");
     config.sampling_period = arguments.as<std::uint64_t>("count");
     config.enable_cct = arguments.given("call-graph");
+    config.dwarf_unwind = arguments.given("call-graph-dwarf");
     config.suppress_ip = arguments.given("no-ip");
+    config.line_info = arguments.given("line-info");
+    config.defer_symbols = arguments.given("defer-symbols");
+    if (arguments.provided("symbol-cache"))
+    {
+        config.symbol_cache_dir = arguments.get("symbol-cache");
+    }
+    config.symbol_cache_size = arguments.as<std::size_t>("symbol-cache-size") * 1024 * 1024;
     config.tracepoint_events = arguments.get_all("tracepoint");
     config.use_x86_energy = arguments.given("x86-energy");
     config.use_sensors = arguments.given("sensors");
@@ -615,6 +773,22 @@ void parse_program_options(int argc, const char** argv)
         std::exit(EXIT_FAILURE);
     }
 
+    if (config.consolidate_buffers)
+    {
+        if (config.monitor_type != lo2s::MonitorType::CPU_SET)
+        {
+            Log::fatal() << "--consolidate-buffers can only be used in system-wide monitoring mode";
+            std::exit(EXIT_FAILURE);
+        }
+
+        // The kernel only redirects events into buffers of events with the same clock
+        if (config.use_pebs)
+        {
+            Log::fatal() << "--consolidate-buffers can not be combined with --clockid pebs";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
     config.read_interval =
         std::chrono::milliseconds(arguments.as<std::uint64_t>("readout-interval"));
 
@@ -627,6 +801,104 @@ void parse_program_options(int argc, const char** argv)
             std::chrono::milliseconds(arguments.as<std::uint64_t>("perf-readout-interval"));
     }
 
+    config.metric_suppress_unchanged = arguments.given("metric-suppress-unchanged");
+    config.metric_tolerance = arguments.as<double>("metric-tolerance");
+    config.metric_heartbeat = arguments.as<std::size_t>("metric-heartbeat");
+    config.cpuid_suppress_unchanged = arguments.given("cpuid-suppress-unchanged");
+    config.cpuid_heartbeat = arguments.as<std::size_t>("cpuid-heartbeat");
+
+    if (arguments.provided("merge-interval"))
+    {
+        config.cctx_merge_interval =
+            std::chrono::milliseconds(arguments.as<std::uint64_t>("merge-interval"));
+    }
+
+    config.reorder_window = arguments.as<std::size_t>("reorder-window");
+
+    if (arguments.provided("profile-window"))
+    {
+        config.profile_window =
+            std::chrono::milliseconds(arguments.as<std::uint64_t>("profile-window"));
+    }
+
+    if (arguments.provided("monitor-workers"))
+    {
+        if (config.monitor_type != lo2s::MonitorType::PROCESS)
+        {
+            Log::fatal() << "--monitor-workers can only be used in process monitoring mode";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if (arguments.get("monitor-workers") == "auto")
+        {
+            config.monitor_workers = Topology::instance().cpus().size();
+        }
+        else
+        {
+            config.monitor_workers = arguments.as<std::size_t>("monitor-workers");
+        }
+    }
+
+    if (arguments.provided("flight-recorder"))
+    {
+#ifdef HAVE_PERF_WRITE_BACKWARD
+        if (config.monitor_type != lo2s::MonitorType::CPU_SET || !config.command.empty() ||
+            config.process != Process::invalid())
+        {
+            Log::fatal() << "--flight-recorder can only be used in system-wide monitoring mode "
+                            "without a COMMAND or PID";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if (!config.tracepoint_events.empty() || config.use_block_io)
+        {
+            Log::fatal() << "--flight-recorder can not be combined with tracepoint or block I/O "
+                            "recording";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if (config.adaptive_buffers)
+        {
+            Log::warn() << "--adaptive-buffers has no effect in flight recorder mode";
+            config.adaptive_buffers = false;
+        }
+
+        config.flight_recorder = true;
+        config.flight_recorder_window =
+            std::chrono::seconds(arguments.as<std::uint64_t>("flight-recorder"));
+#else
+        Log::fatal() << "lo2s was built without support for backward perf buffers; "
+                        "cannot use --flight-recorder.";
+        std::exit(EXIT_FAILURE);
+#endif
+    }
+
+    if (config.dwarf_unwind)
+    {
+#if defined(HAVE_LIBDW) && defined(__x86_64__)
+        // The kernel requires a multiple of 8 that fits into the 16 bit size of a perf record
+        config.stack_dump_size = arguments.as<std::size_t>("stack-dump-size") & ~std::size_t(7);
+        if (config.stack_dump_size == 0 || config.stack_dump_size > 65000)
+        {
+            Log::fatal() << "--stack-dump-size must be between 8 and 65000 bytes";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if (!config.sampling)
+        {
+            Log::fatal() << "--call-graph-dwarf requires instruction sampling";
+            std::exit(EXIT_FAILURE);
+        }
+
+        // Kernel frames are still recorded by perf, the user part of the callchain is unwound
+        config.enable_cct = true;
+#else
+        Log::fatal() << "lo2s was built without libdw or for an unsupported architecture; "
+                        "cannot use --call-graph-dwarf.";
+        std::exit(EXIT_FAILURE);
+#endif
+    }
+
     if (!arguments.given("disassemble"))
     {
         config.disassemble = false;
@@ -644,6 +916,15 @@ void parse_program_options(int argc, const char** argv)
 #endif
     }
 
+    if (config.defer_symbols && config.disassemble)
+    {
+        if (arguments.provided("disassemble"))
+        {
+            Log::warn() << "Cannot disassemble instructions with --defer-symbols.";
+        }
+        config.disassemble = false;
+    }
+
     if (arguments.provided("metric-count") && !arguments.provided("metric-leader"))
     {
         Log::fatal() << "--metric-count can only be used in conjunction with a --metric-leader";
@@ -693,6 +974,30 @@ void parse_program_options(int argc, const char** argv)
         perf_group_events.emplace_back("cpu-cycles");
     }
 
+    if (arguments.given("inherit"))
+    {
+        if (config.monitor_type != lo2s::MonitorType::PROCESS)
+        {
+            Log::fatal() << "--inherit can only be used in process monitoring mode";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if (config.monitor_workers != 0)
+        {
+            Log::fatal() << "--inherit can not be combined with --monitor-workers";
+            std::exit(EXIT_FAILURE);
+        }
+
+        // The kernel does not allow inheriting events that read their group in samples
+        if (!perf_group_events.empty() || !perf_userspace_events.empty())
+        {
+            Log::fatal() << "--inherit can not be combined with metric recording";
+            std::exit(EXIT_FAILURE);
+        }
+
+        config.inherit = true;
+    }
+
     perf::counter::CounterProvider::instance().initialize_group_counters(
         arguments.get("metric-leader"), perf_group_events);
     perf::counter::CounterProvider::instance().initialize_userspace_counters(perf_userspace_events);
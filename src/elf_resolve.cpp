@@ -0,0 +1,468 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/elf_resolve.hpp>
+#include <lo2s/log.hpp>
+#include <lo2s/symbol_cache.hpp>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <cxxabi.h>
+
+extern "C"
+{
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace lo2s
+{
+namespace elfr
+{
+
+namespace
+{
+std::string demangle(const char* name)
+{
+    if (std::strncmp(name, "_Z", 2) != 0)
+    {
+        return name;
+    }
+
+    int status = 0;
+    std::unique_ptr<char, decltype(&std::free)> demangled(
+        abi::__cxa_demangle(name, nullptr, nullptr, &status), &std::free);
+    if (status != 0 || !demangled)
+    {
+        return name;
+    }
+    return demangled.get();
+}
+
+template <typename Shdr>
+bool in_file(const Shdr& section, std::size_t size)
+{
+    return section.sh_type != SHT_NOBITS && section.sh_offset <= size &&
+           section.sh_size <= size - section.sh_offset;
+}
+
+template <typename Ehdr, typename Shdr>
+const Shdr* section_headers(const char* elf, std::size_t size)
+{
+    if (size < sizeof(Ehdr))
+    {
+        return nullptr;
+    }
+    const auto* ehdr = reinterpret_cast<const Ehdr*>(elf);
+    if (ehdr->e_shnum == 0 || ehdr->e_shentsize != sizeof(Shdr) || ehdr->e_shoff > size ||
+        (size - ehdr->e_shoff) / sizeof(Shdr) < ehdr->e_shnum)
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<const Shdr*>(elf + ehdr->e_shoff);
+}
+} // namespace
+
+Lib::Lib(const std::string& name) : name_(name)
+{
+    int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw InitError("could not open file", name);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < EI_NIDENT)
+    {
+        close(fd);
+        throw InitError("not a regular file", name);
+    }
+
+    std::size_t size = st.st_size;
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        throw InitError("could not mmap file", name);
+    }
+    const auto* elf = static_cast<const char*>(data);
+
+    try
+    {
+        if (std::memcmp(elf, ELFMAG, SELFMAG) != 0)
+        {
+            throw InitError("not an ELF file", name);
+        }
+
+        auto& cache = SymbolCache::instance();
+        std::string key;
+        if (cache.enabled())
+        {
+            auto build_id = (elf[EI_CLASS] == ELFCLASS64) ?
+                                read_build_id<Elf64_Ehdr, Elf64_Shdr>(elf, size) :
+                                read_build_id<Elf32_Ehdr, Elf32_Shdr>(elf, size);
+            if (!build_id.empty())
+            {
+                key = "b-" + build_id;
+            }
+            else
+            {
+                key = fmt::format("p-{:016x}-{}-{}.{:09}", std::hash<std::string>()(name),
+                                  st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+            }
+
+            auto path = cache.find(key);
+            if (!path.empty() && map_image(path))
+            {
+                Log::debug() << "loaded " << num_symbols_ << " function symbols of " << name
+                             << " from " << path;
+                ::munmap(data, size);
+                return;
+            }
+        }
+
+        build_image(elf, size);
+
+        if (cache.enabled())
+        {
+            cache.store(key, built_image_.data(), built_image_.size());
+        }
+    }
+    catch (...)
+    {
+        ::munmap(data, size);
+        throw;
+    }
+    ::munmap(data, size);
+
+    Log::debug() << "indexed " << num_symbols_ << " function symbols in " << name;
+}
+
+Lib::~Lib()
+{
+    if (mapped_image_ != nullptr)
+    {
+        ::munmap(mapped_image_, mapped_size_);
+    }
+}
+
+void Lib::build_image(const char* elf, std::size_t size)
+{
+    std::vector<Symbol> symbols;
+    switch (elf[EI_CLASS])
+    {
+    case ELFCLASS64:
+        symbols = read_symbols<Elf64_Ehdr, Elf64_Shdr, Elf64_Sym>(elf, size);
+        break;
+    case ELFCLASS32:
+        symbols = read_symbols<Elf32_Ehdr, Elf32_Shdr, Elf32_Sym>(elf, size);
+        break;
+    default:
+        throw InitError("unknown ELF class", name_);
+    }
+
+    if (symbols.empty())
+    {
+        throw InitError("could not find any function symbols in .symtab or .dynsym", name_);
+    }
+
+    // Copy only the names that are still referenced, so the image does not need the ELF file
+    std::string strings;
+    for (auto& symbol : symbols)
+    {
+        const char* sym_name = elf + symbol.name;
+        symbol.name = strings.size();
+        strings.append(sym_name, std::strlen(sym_name) + 1);
+    }
+
+    ImageHeader header{ ImageHeader::MAGIC, ImageHeader::VERSION, symbols.size(), strings.size() };
+    built_image_.resize(sizeof(header) + symbols.size() * sizeof(Symbol) + strings.size());
+    auto* out = built_image_.data();
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    std::memcpy(out, symbols.data(), symbols.size() * sizeof(Symbol));
+    out += symbols.size() * sizeof(Symbol);
+    std::memcpy(out, strings.data(), strings.size());
+
+    use_image(built_image_.data(), built_image_.size());
+}
+
+template <typename Ehdr, typename Shdr, typename Sym>
+std::vector<Lib::Symbol> Lib::read_symbols(const char* elf, std::size_t size)
+{
+    const auto* shdrs = section_headers<Ehdr, Shdr>(elf, size);
+    if (shdrs == nullptr)
+    {
+        return {};
+    }
+    const std::size_t shnum = reinterpret_cast<const Ehdr*>(elf)->e_shnum;
+
+    std::vector<Symbol> symbols;
+    auto read_table = [&](uint32_t type) {
+        for (std::size_t i = 0; i < shnum; i++)
+        {
+            const auto& symtab = shdrs[i];
+            if (symtab.sh_type != type || symtab.sh_entsize != sizeof(Sym) ||
+                !in_file(symtab, size) || symtab.sh_link >= shnum)
+            {
+                continue;
+            }
+            const auto& strtab = shdrs[symtab.sh_link];
+            // Every name must be terminated within the string table
+            if (!in_file(strtab, size) || strtab.sh_size == 0 ||
+                elf[strtab.sh_offset + strtab.sh_size - 1] != '\0')
+            {
+                continue;
+            }
+
+            const auto* syms = reinterpret_cast<const Sym*>(elf + symtab.sh_offset);
+            for (std::size_t j = 0; j < symtab.sh_size / sizeof(Sym); j++)
+            {
+                const auto& sym = syms[j];
+                auto sym_type = sym.st_info & 0xf;
+                if ((sym_type != STT_FUNC && sym_type != STT_GNU_IFUNC) ||
+                    sym.st_shndx == SHN_UNDEF || sym.st_shndx >= shnum ||
+                    sym.st_name >= strtab.sh_size)
+                {
+                    continue;
+                }
+                // Samples are resolved by file offset, like the section filepos used by bfdr
+                const auto& section = shdrs[sym.st_shndx];
+                if (!in_file(section, size) || sym.st_value < section.sh_addr)
+                {
+                    continue;
+                }
+                uint64_t start = sym.st_value - section.sh_addr + section.sh_offset;
+                symbols.push_back({ start, start + sym.st_size, strtab.sh_offset + sym.st_name });
+            }
+        }
+    };
+
+    // Use dynamic symtab only when regular symbols are not available, same as bfdr::Lib
+    read_table(SHT_SYMTAB);
+    if (symbols.empty())
+    {
+        read_table(SHT_DYNSYM);
+    }
+
+    // Aliases share a start address, keep the one covering the most bytes
+    std::sort(symbols.begin(), symbols.end(), [](const Symbol& a, const Symbol& b) {
+        return a.start < b.start || (a.start == b.start && a.end > b.end);
+    });
+    symbols.erase(std::unique(symbols.begin(), symbols.end(),
+                              [](const Symbol& a, const Symbol& b) { return a.start == b.start; }),
+                  symbols.end());
+
+    // Symbols without a size (usually hand-written assembly) extend to the next symbol
+    for (std::size_t i = 0; i < symbols.size(); i++)
+    {
+        if (symbols[i].end == symbols[i].start)
+        {
+            symbols[i].end =
+                (i + 1 < symbols.size()) ? symbols[i + 1].start : symbols[i].start + 1;
+        }
+    }
+    return symbols;
+}
+
+template <typename Ehdr, typename Shdr>
+std::string Lib::read_build_id(const char* elf, std::size_t size)
+{
+    const auto* shdrs = section_headers<Ehdr, Shdr>(elf, size);
+    if (shdrs == nullptr)
+    {
+        return {};
+    }
+    const std::size_t shnum = reinterpret_cast<const Ehdr*>(elf)->e_shnum;
+
+    auto align = [](std::size_t n) { return (n + 3) & ~std::size_t(3); };
+
+    for (std::size_t i = 0; i < shnum; i++)
+    {
+        const auto& section = shdrs[i];
+        if (section.sh_type != SHT_NOTE || !in_file(section, size))
+        {
+            continue;
+        }
+
+        // Note headers have the same layout for 32 and 64 bit ELF files
+        std::size_t pos = 0;
+        while (pos + sizeof(Elf64_Nhdr) <= section.sh_size)
+        {
+            const auto* note = reinterpret_cast<const Elf64_Nhdr*>(elf + section.sh_offset + pos);
+            std::size_t name_pos = pos + sizeof(Elf64_Nhdr);
+            std::size_t desc_pos = name_pos + align(note->n_namesz);
+            std::size_t next = desc_pos + align(note->n_descsz);
+            if (next > section.sh_size)
+            {
+                break;
+            }
+
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == sizeof(ELF_NOTE_GNU) &&
+                std::memcmp(elf + section.sh_offset + name_pos, ELF_NOTE_GNU,
+                            sizeof(ELF_NOTE_GNU)) == 0)
+            {
+                std::string build_id;
+                const auto* desc =
+                    reinterpret_cast<const unsigned char*>(elf + section.sh_offset + desc_pos);
+                for (std::size_t j = 0; j < note->n_descsz; j++)
+                {
+                    build_id += fmt::format("{:02x}", desc[j]);
+                }
+                return build_id;
+            }
+            pos = next;
+        }
+    }
+    return {};
+}
+
+std::string Lib::build_id(const std::string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return {};
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < EI_NIDENT)
+    {
+        close(fd);
+        return {};
+    }
+
+    void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return {};
+    }
+
+    std::string id;
+    const auto* elf = static_cast<const char*>(data);
+    if (std::memcmp(elf, ELFMAG, SELFMAG) == 0)
+    {
+        id = (elf[EI_CLASS] == ELFCLASS64) ?
+                 read_build_id<Elf64_Ehdr, Elf64_Shdr>(elf, st.st_size) :
+                 read_build_id<Elf32_Ehdr, Elf32_Shdr>(elf, st.st_size);
+    }
+    ::munmap(data, st.st_size);
+    return id;
+}
+
+bool Lib::map_image(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    if (!use_image(static_cast<const char*>(data), st.st_size))
+    {
+        Log::debug() << "ignoring malformed symbol cache entry " << path;
+        ::munmap(data, st.st_size);
+        return false;
+    }
+
+    mapped_image_ = data;
+    mapped_size_ = st.st_size;
+    return true;
+}
+
+bool Lib::use_image(const char* image, std::size_t size)
+{
+    if (size < sizeof(ImageHeader))
+    {
+        return false;
+    }
+    ImageHeader header;
+    std::memcpy(&header, image, sizeof(header));
+    if (header.magic != ImageHeader::MAGIC || header.version != ImageHeader::VERSION ||
+        header.num_symbols == 0 ||
+        header.num_symbols > (size - sizeof(header)) / sizeof(Symbol) ||
+        header.strings_size != size - sizeof(header) - header.num_symbols * sizeof(Symbol) ||
+        header.strings_size == 0)
+    {
+        return false;
+    }
+
+    const auto* symbols = reinterpret_cast<const Symbol*>(image + sizeof(header));
+    const char* strings = image + sizeof(header) + header.num_symbols * sizeof(Symbol);
+    if (strings[header.strings_size - 1] != '\0' ||
+        std::any_of(symbols, symbols + header.num_symbols,
+                    [&header](const Symbol& s) { return s.name >= header.strings_size; }))
+    {
+        return false;
+    }
+
+    symbols_ = symbols;
+    num_symbols_ = header.num_symbols;
+    strings_ = strings;
+    return true;
+}
+
+const std::string& Lib::lookup(Address addr) const
+{
+    auto it = std::upper_bound(
+        symbols_, symbols_ + num_symbols_, addr.value(),
+        [](uint64_t value, const Symbol& symbol) { return value < symbol.start; });
+    if (it == symbols_ || addr.value() >= (--it)->end)
+    {
+        throw LookupError("no function symbol at", addr);
+    }
+
+    std::lock_guard<std::mutex> lock(demangled_mutex_);
+    auto [demangled, inserted] = demangled_.try_emplace(it - symbols_);
+    if (inserted)
+    {
+        demangled->second = demangle(strings_ + it->name);
+    }
+    return demangled->second;
+}
+} // namespace elfr
+} // namespace lo2s
@@ -27,6 +27,8 @@
 
 #include <system_error>
 
+#include <csignal>
+
 int main(int argc, const char** argv)
 {
     try
@@ -34,6 +36,16 @@ int main(int argc, const char** argv)
         lo2s::parse_program_options(argc, argv);
         lo2s::summary();
 
+        if (lo2s::config().flight_recorder)
+        {
+            // Block SIGUSR2 before any monitoring thread is started, so that it only ends up in
+            // the sigwait() of CpuSetMonitor::run()
+            sigset_t ss;
+            sigemptyset(&ss);
+            sigaddset(&ss, SIGUSR2);
+            pthread_sigmask(SIG_BLOCK, &ss, NULL);
+        }
+
         switch (lo2s::config().monitor_type)
         {
         case lo2s::MonitorType::CPU_SET:
@@ -28,6 +28,8 @@
 
 #include <nitro/lang/enumerate.hpp>
 
+#include <iterator>
+
 #include <cstring>
 
 namespace lo2s
@@ -42,7 +44,8 @@ MetricRecorder::MetricRecorder(trace::Trace& trace, Gpu gpu, otf2::definition::m
 : PollMonitor(trace, "gpu " + std::to_string(gpu.as_int()) + " (" + gpu.name() + ")", config().read_interval),
   otf2_writer_(trace.create_metric_writer(name())),
   metric_instance_(trace.metric_instance(metric_class, otf2_writer_.location(),
-                                         trace.system_tree_gpu_node(gpu)))
+                                         trace.system_tree_gpu_node(gpu))),
+  filter_(NUM_FILTERED_VALUES)
 {
 
     result = nvmlDeviceGetHandleByIndex(gpu.as_int(), &device);
@@ -115,24 +118,39 @@ void MetricRecorder::monitor([[maybe_unused]] int fd)
     auto time_taken = time::now() - start;
     
 
-    event_->raw_values()[0] = double(power)/1000;
-    event_->raw_values()[1] = double(temp);
-    event_->raw_values()[2] = double(fan_speed);
-    event_->raw_values()[3] = double(g_clock)/1000;
-    event_->raw_values()[4] = double(sm_clock)/1000;
-    event_->raw_values()[5] = double(mem_clock)/1000;
-    event_->raw_values()[6] = double(vid_clock)/1000;
-    event_->raw_values()[7] = double(utilization.gpu);
-    event_->raw_values()[8] = double(utilization.memory);
-    event_->raw_values()[9] = double(p_state);
-    event_->raw_values()[10] = double(tx)/1024;
-    event_->raw_values()[11] = double(rx)/1024;
-    event_->raw_values()[12] = double(energy/1000);
-    event_->raw_values()[13] = double(clocksThrottleReasons);
-    event_->raw_values()[14] = double(std::chrono::duration_cast<std::chrono::microseconds>(time_taken).count())/1000;
+    const double values[] = {
+        double(power) / 1000,
+        double(temp),
+        double(fan_speed),
+        double(g_clock) / 1000,
+        double(sm_clock) / 1000,
+        double(mem_clock) / 1000,
+        double(vid_clock) / 1000,
+        double(utilization.gpu),
+        double(utilization.memory),
+        double(p_state),
+        double(tx) / 1024,
+        double(rx) / 1024,
+        double(energy / 1000),
+        double(clocksThrottleReasons),
+        double(std::chrono::duration_cast<std::chrono::microseconds>(time_taken).count()) / 1000
+    };
+
+    for (std::size_t i = 0; i < std::size(values); i++)
+    {
+        event_->raw_values()[i] = values[i];
+        // The monitoring time changes every time, so it is not considered for suppression
+        if (i < NUM_FILTERED_VALUES)
+        {
+            filter_.value(i, values[i]);
+        }
+    }
 
     // write event to archive
-    otf2_writer_.write(*event_);
+    if (filter_.should_write())
+    {
+        otf2_writer_.write(*event_);
+    }
 }
 
 MetricRecorder::~MetricRecorder()
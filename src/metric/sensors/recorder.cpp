@@ -137,6 +137,7 @@ Recorder::Recorder(trace::Trace& trace)
     }
 
     event_ = std::make_unique<otf2::event::metric>(otf2::chrono::genesis(), metric_instance_);
+    filter_.emplace(items_.size());
 }
 
 void Recorder::monitor([[maybe_unused]] int fd)
@@ -157,10 +158,14 @@ void Recorder::monitor([[maybe_unused]] int fd)
 
         auto i = index_items.index();
         event_->raw_values()[i] = value;
+        filter_->value(i, value);
     }
 
     // write event to archive
-    otf2_writer_.write(*event_);
+    if (filter_->should_write())
+    {
+        otf2_writer_.write(*event_);
+    }
 }
 
 Recorder::~Recorder()
@@ -22,7 +22,7 @@ NodeMonitor::NodeMonitor(::x86_adapt::device device,
   configuration_items_(configuration_items),
   metric_instance_(trace.metric_instance(metric_class, otf2_writer_.location(),
                                          trace.system_tree_package_node(Package(device_.id())))),
-  event_(otf2::chrono::genesis(), metric_instance_)
+  event_(otf2::chrono::genesis(), metric_instance_), filter_(configuration_items_.size())
 {
     assert(device_.type() == X86_ADAPT_DIE);
 }
@@ -41,10 +41,15 @@ void NodeMonitor::monitor([[maybe_unused]] int fd)
         auto i = index_ci.index();
         auto configuration_item = index_ci.value();
 
-        event_.raw_values()[i] = device_(configuration_item);
+        auto value = device_(configuration_item);
+        event_.raw_values()[i] = value;
+        filter_.value(i, value);
     }
 
-    otf2_writer_.write(event_);
+    if (filter_.should_write())
+    {
+        otf2_writer_.write(event_);
+    }
 }
 } // namespace x86_adapt
 } // namespace metric
@@ -19,6 +19,7 @@
  * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <lo2s/config.hpp>
 #include <lo2s/line_info.hpp>
 #include <lo2s/mmap.hpp>
 #include <lo2s/util.hpp>
@@ -98,21 +99,7 @@ void MemoryMap::mmap(const RawMemoryMapEntry& entry)
     }
     else
     {
-        try
-        {
-
-            lb = &BfdRadareBinary::cache(entry.filename);
-        }
-        catch (bfdr::InitError& e)
-        {
-            Log::warn() << "could not initialize bfd: " << e.what();
-            lb = &NamedBinary::cache(entry.filename);
-        }
-        catch (bfdr::InvalidFileError& e)
-        {
-            Log::debug() << "dso is not a valid file: " << e.what();
-            lb = &NamedBinary::cache(entry.filename);
-        }
+        lb = &BfdRadareBinary::cache(entry.filename);
     }
 
     auto ex_it = map_.find(entry.addr);
@@ -166,7 +153,7 @@ LineInfo MemoryMap::lookup_line_info(Address ip) const
     catch (std::out_of_range&)
     {
         // This will just happen a lot in practice
-        Log::trace() << "no mapping found for address " << ip;
+        LO2S_HOT_LOG(trace) << "no mapping found for address " << ip;
         // Graceful fallback
         return LineInfo::for_unknown_function();
     }
@@ -177,4 +164,114 @@ std::string MemoryMap::lookup_instruction(Address ip) const
     auto& mapping = map_.at(ip);
     return mapping.dso.lookup_instruction(ip - mapping.start + mapping.pgoff);
 }
+
+std::pair<Binary*, Address> MemoryMap::lookup_binary(Address ip) const
+{
+    auto& mapping = map_.at(ip);
+    return { &mapping.dso, ip - mapping.start + mapping.pgoff };
+}
+
+const elfr::Lib* BfdRadareBinary::elf()
+{
+    std::call_once(elf_once_, [this]() {
+        try
+        {
+            elf_ = std::make_unique<elfr::Lib>(name());
+        }
+        catch (elfr::InitError& e)
+        {
+            Log::debug() << "could not index symbols: " << e.what();
+        }
+    });
+    return elf_.get();
+}
+
+const bfdr::Lib* BfdRadareBinary::bfd()
+{
+    std::call_once(bfd_once_, [this]() {
+        try
+        {
+            // The function names come from the ELF index whenever there is one
+            bfd_ = std::make_unique<bfdr::Lib>(name(), elf() == nullptr);
+        }
+        catch (bfdr::InitError& e)
+        {
+            Log::warn() << "could not initialize bfd: " << e.what();
+        }
+        catch (bfdr::InvalidFileError& e)
+        {
+            Log::debug() << "dso is not a valid file: " << e.what();
+        }
+    });
+    return bfd_.get();
+}
+
+LineInfo BfdRadareBinary::lookup_line_info(Address ip)
+{
+    const std::string* function = nullptr;
+    if (const auto* lib = elf())
+    {
+        try
+        {
+            function = &lib->lookup(ip);
+        }
+        catch (elfr::LookupError&)
+        {
+            // Maybe BFD still finds the function
+        }
+    }
+
+    // BFD is only asked for the source file and line, as its lookup is much more expensive
+    if (config().line_info)
+    {
+        if (const auto* lib = bfd())
+        {
+            try
+            {
+                auto line_info = lib->lookup(ip);
+                if (function == nullptr)
+                {
+                    return line_info;
+                }
+                return LineInfo::for_function(line_info.file().c_str(), function->c_str(),
+                                              line_info.line(), name());
+            }
+            catch (bfdr::LookupError&)
+            {
+                // Without debug information, the function name is all we get
+            }
+        }
+    }
+
+    if (function != nullptr)
+    {
+        return LineInfo::for_function(nullptr, function->c_str(), 0, name());
+    }
+    if (elf() == nullptr && !(config().line_info && bfd() != nullptr))
+    {
+        return LineInfo::for_binary(name());
+    }
+    return LineInfo::for_unknown_function_in_dso(name());
+}
+
+#ifdef HAVE_RADARE
+std::string BfdRadareBinary::lookup_instruction(Address ip)
+{
+    std::call_once(radare_once_, [this]() {
+        try
+        {
+            radare_ = std::make_unique<RadareResolver>(name());
+        }
+        catch (std::ios_base::failure& e)
+        {
+            Log::debug() << "could not open " << name() << " for disassembly: " << e.what();
+        }
+    });
+    if (!radare_)
+    {
+        throw std::domain_error("Unknown instruction.");
+    }
+    return radare_->instruction(ip);
+}
+#endif
 } // namespace lo2s
@@ -52,7 +52,7 @@ void BioMonitor::finalize_thread()
 
 void BioMonitor::monitor(int fd)
 {
-    if (fd == timer_pfd().fd)
+    if (fd == timer_fd())
     {
         return;
     }
@@ -0,0 +1,49 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/monitor/cctx_merge_monitor.hpp>
+
+#include <lo2s/config.hpp>
+#include <lo2s/monitor/main_monitor.hpp>
+
+namespace lo2s
+{
+namespace monitor
+{
+
+CctxMergeMonitor::CctxMergeMonitor(MainMonitor& main_monitor)
+: PollMonitor(main_monitor.trace(), "calling context merger", config().cctx_merge_interval),
+  main_monitor_(main_monitor)
+{
+}
+
+void CctxMergeMonitor::monitor(int fd)
+{
+    // Deltas that are handed off after the last wakeup are merged by the final
+    // Trace::merge_calling_contexts()
+    if (fd == timer_fd())
+    {
+        main_monitor_.merge_pending_calling_contexts();
+    }
+}
+} // namespace monitor
+} // namespace lo2s
@@ -51,6 +51,7 @@ CpuSetMonitor::CpuSetMonitor() : MainMonitor()
     const std::filesystem::path proc_path("/proc");
     if (config().sampling)
     {
+        std::lock_guard<std::mutex> lock(process_infos_mutex_);
         for (const auto& p : std::filesystem::directory_iterator(proc_path))
         {
             std::string path = p.path().string();
@@ -103,6 +104,10 @@ void CpuSetMonitor::run()
     {
         sigemptyset(&ss);
         sigaddset(&ss, SIGINT);
+        if (config().flight_recorder)
+        {
+            sigaddset(&ss, SIGUSR2);
+        }
 
         auto ret = pthread_sigmask(SIG_BLOCK, &ss, NULL);
         if (ret)
@@ -116,8 +121,17 @@ void CpuSetMonitor::run()
     {
         int sig;
         auto ret = sigwait(&ss, &sig);
-        std::cout << "[ lo2s: Encountered SIGINT. Stopping measurements and closing trace ]"
-                  << std::endl;
+        if (sig == SIGUSR2)
+        {
+            std::cout << "[ lo2s: Encountered SIGUSR2. Writing flight recorder snapshot and "
+                         "closing trace ]"
+                      << std::endl;
+        }
+        else
+        {
+            std::cout << "[ lo2s: Encountered SIGINT. Stopping measurements and closing trace ]"
+                      << std::endl;
+        }
         if (ret)
         {
             throw make_system_error();
@@ -27,6 +27,7 @@
 #include <lo2s/topology.hpp>
 #include <lo2s/trace/trace.hpp>
 
+#include <algorithm>
 #include <thread>
 
 namespace lo2s
@@ -38,6 +39,12 @@ MainMonitor::MainMonitor() : trace_(), metrics_(trace_)
     if (config().sampling)
     {
         perf::time::Converter::instance();
+
+        if (config().cctx_merge_interval.count() != 0)
+        {
+            cctx_merge_monitor_ = std::make_unique<CctxMergeMonitor>(*this);
+            cctx_merge_monitor_->start();
+        }
     }
 
     metrics_.start();
@@ -196,15 +203,40 @@ MainMonitor::MainMonitor() : trace_(), metrics_(trace_)
 
 void MainMonitor::insert_cached_mmap_events(const RawMemoryMapCache& cached_events)
 {
-    for (auto& event : cached_events)
+    std::lock_guard<std::mutex> lock(process_infos_mutex_);
+    for (auto begin = cached_events.begin(); begin != cached_events.end();)
     {
+        // Publish only one new memory map snapshot per run of events for the same process
+        auto end = std::find_if(begin, cached_events.end(),
+                                [begin](const RawMemoryMapEntry& event)
+                                { return event.process != begin->process; });
+
         auto process_info =
-            process_infos_.emplace(std::piecewise_construct, std::forward_as_tuple(event.process),
-                                   std::forward_as_tuple(event.process, true));
-        process_info.first->second.mmap(event);
+            process_infos_.emplace(std::piecewise_construct, std::forward_as_tuple(begin->process),
+                                   std::forward_as_tuple(begin->process, true));
+        process_info.first->second.mmap(begin, end);
+        begin = end;
     }
 }
 
+ProcessMaps MainMonitor::process_maps()
+{
+    ProcessMaps maps;
+    std::lock_guard<std::mutex> lock(process_infos_mutex_);
+    for (const auto& [process, info] : process_infos_)
+    {
+        maps.emplace(process, info.maps());
+    }
+    return maps;
+}
+
+void MainMonitor::merge_pending_calling_contexts()
+{
+    // Resolving and unwinding takes a while. Sample writers must still be able to publish new
+    // mappings in the meantime, or their buffers run full.
+    trace_.merge_pending_calling_contexts(process_maps());
+}
+
 MainMonitor::~MainMonitor()
 {
     // Note: call stop() in reverse order than start() in constructor
@@ -269,7 +301,12 @@ MainMonitor::~MainMonitor()
 
     metrics_.stop();
 
-    trace_.merge_calling_contexts(get_process_infos());
+    if (cctx_merge_monitor_)
+    {
+        cctx_merge_monitor_->stop();
+    }
+
+    trace_.merge_calling_contexts(process_maps());
 }
 } // namespace monitor
 } // namespace lo2s
@@ -23,6 +23,9 @@
 #include <lo2s/error.hpp>
 #include <lo2s/monitor/poll_monitor.hpp>
 
+#include <fmt/core.h>
+
+#include <algorithm>
 #include <cmath>
 extern "C"
 {
@@ -37,10 +40,18 @@ PollMonitor::PollMonitor(trace::Trace& trace, const std::string& name,
                          std::chrono::nanoseconds read_interval)
 : ThreadedMonitor(trace, name)
 {
-    pfds_.resize(2);
-    stop_pfd().fd = stop_pipe_.read_fd();
-    stop_pfd().events = POLLIN;
-    stop_pfd().revents = 0;
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ == -1)
+    {
+        Log::error() << "Creating epoll instance failed";
+        throw_errno();
+    }
+
+    add_fd(stop_pipe_.read_fd(), [this]() {
+        monitor(stop_fd());
+        Log::debug() << "Requested stop of PollMonitor";
+        stop_requested_ = true;
+    });
 
     // Create and initialize timer_fd
     struct itimerspec tspec;
@@ -58,28 +69,90 @@ PollMonitor::PollMonitor(trace::Trace& trace, const std::string& name,
 
         tspec.it_interval.tv_nsec = (read_interval % std::chrono::seconds(1)).count();
 
-        timer_pfd().fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-        timer_pfd().events = POLLIN;
-        timer_pfd().revents = 0;
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
 
-        timerfd_settime(timer_pfd().fd, TFD_TIMER_ABSTIME, &tspec, NULL);
+        timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &tspec, NULL);
+
+        add_fd(timer_fd_, [this]() {
+            monitor(timer_fd());
+
+            // Flush timer
+            [[maybe_unused]] uint64_t expirations;
+            if (read(timer_fd_, &expirations, sizeof(expirations)) == -1)
+            {
+                Log::error() << "Flushing timer fd failed";
+                throw_errno();
+            }
+        });
     }
-    else
+}
+
+void PollMonitor::add_fd(int fd, std::function<void()> handler)
+{
+    auto& entry = handlers_.emplace_back(Handler{ fd, std::move(handler) });
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &entry;
+
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == -1)
     {
-        // fd = -1 is just going to be ignored
-        timer_pfd().fd = -1;
-        timer_pfd().events = 0;
-        timer_pfd().revents = 0;
+        handlers_.pop_back();
+        Log::error() << "Adding fd " << fd << " to epoll instance failed";
+        throw_errno();
     }
+
+    ready_events_.resize(handlers_.size());
 }
 
 void PollMonitor::add_fd(int fd)
 {
-    struct pollfd pfd;
-    pfd.fd = fd;
-    pfd.events = POLLIN;
-    pfd.revents = 0;
-    pfds_.push_back(pfd);
+    add_fd(fd, [this, fd]() { monitor(fd); });
+}
+
+void PollMonitor::remove_fd(int fd)
+{
+    auto handler = std::find_if(handlers_.begin(), handlers_.end(), [fd](const Handler& handler) {
+        return handler.fd == fd && handler.callback;
+    });
+    if (handler == handlers_.end())
+    {
+        return;
+    }
+
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) == -1)
+    {
+        Log::error() << "Removing fd " << fd << " from epoll instance failed";
+        throw_errno();
+    }
+
+    handler->callback = nullptr;
+    handlers_removed_ = true;
+}
+
+void PollMonitor::start()
+{
+    if (config().self_metrics)
+    {
+        self_metrics_ = std::make_unique<SelfMetrics>(trace_, name());
+    }
+    ThreadedMonitor::start();
+}
+
+std::function<void(const perf::ReadStats&)>
+PollMonitor::self_metrics(const std::string& reader_name)
+{
+    if (!config().self_metrics)
+    {
+        return {};
+    }
+
+    auto& metrics = reader_metrics_.emplace_back(trace_, fmt::format("{} {}", name(), reader_name));
+    return [this, &metrics](const perf::ReadStats& stats) {
+        metrics.write(stats);
+        wakeup_stats_ += stats;
+    };
 }
 
 void PollMonitor::stop()
@@ -96,41 +169,48 @@ void PollMonitor::stop()
 
 void PollMonitor::monitor()
 {
-    for (const auto& pfd : pfds_)
+    for (int i = 0; i < num_ready_; i++)
     {
-        if (pfd.revents & POLLIN)
+        auto* handler = static_cast<Handler*>(ready_events_[i].data.ptr);
+        if ((ready_events_[i].events & EPOLLIN) && handler->callback)
         {
-            monitor(pfd.fd);
+            handler->callback();
         }
     }
+
+    if (handlers_removed_)
+    {
+        handlers_.remove_if([](const Handler& handler) { return !handler.callback; });
+        handlers_removed_ = false;
+    }
 }
 
 void PollMonitor::run()
 {
-    bool stop_requested = false;
     do
     {
-        auto ret = ::poll(pfds_.data(), pfds_.size(), -1);
+        auto ret = ::epoll_wait(epoll_fd_, ready_events_.data(), ready_events_.size(), -1);
         num_wakeups_++;
 
         if (ret == 0)
         {
-            throw std::runtime_error("Received poll timeout despite requesting no timeout.");
+            throw std::runtime_error("Received epoll timeout despite requesting no timeout.");
         }
         else if (ret < 0)
         {
-            Log::error() << "poll failed";
+            Log::error() << "epoll_wait failed";
             throw_errno();
         }
-        Log::trace() << "PollMonitor poll returned " << ret;
+        LO2S_HOT_LOG(trace) << "PollMonitor epoll_wait returned " << ret;
+        num_ready_ = ret;
 
         bool panic = false;
-        for (const auto& pfd : pfds_)
+        for (int i = 0; i < num_ready_; i++)
         {
-            if (pfd.revents != 0 && pfd.revents != POLLIN)
+            auto* handler = static_cast<Handler*>(ready_events_[i].data.ptr);
+            if (ready_events_[i].events != EPOLLIN && handler->callback &&
+                !unexpected_event(handler->fd, ready_events_[i].events))
             {
-                Log::warn() << "Poll on raw event fds got unexpected event flags: " << pfd.revents
-                            << ". Stopping raw event polling.";
                 panic = true;
             }
         }
@@ -139,32 +219,35 @@ void PollMonitor::run()
             break;
         }
 
-        monitor();
-
-        // Flush timer
-        if (timer_pfd().revents & POLLIN)
+        if (self_metrics_)
         {
-            [[maybe_unused]] uint64_t expirations;
-            if (read(timer_pfd().fd, &expirations, sizeof(expirations)) == -1)
-            {
-                Log::error() << "Flushing timer fd failed";
-                throw_errno();
-            }
+            auto start = std::chrono::steady_clock::now();
+            monitor();
+            wakeup_stats_.duration = std::chrono::steady_clock::now() - start;
+            self_metrics_->write(wakeup_stats_);
+            wakeup_stats_ = perf::ReadStats();
         }
-        if (stop_pfd().revents & POLLIN)
+        else
         {
-            Log::debug() << "Requested stop of PollMonitor";
-            stop_requested = true;
+            monitor();
         }
-    } while (!stop_requested);
+    } while (!stop_requested_);
+}
+
+bool PollMonitor::unexpected_event([[maybe_unused]] int fd, uint32_t events)
+{
+    Log::warn() << "Poll on raw event fds got unexpected event flags: " << events
+                << ". Stopping raw event polling.";
+    return false;
 }
 
 PollMonitor::~PollMonitor()
 {
-    if (timer_pfd().fd != -1)
+    if (timer_fd_ != -1)
     {
-        close(timer_pfd().fd);
+        close(timer_fd_);
     }
+    close(epoll_fd_);
 }
 
 } // namespace monitor
@@ -23,6 +23,9 @@
 #include <lo2s/monitor/scope_monitor.hpp>
 #include <lo2s/perf/counter/counter_provider.hpp>
 #include <lo2s/process_info.hpp>
+#include <lo2s/topology.hpp>
+
+#include <algorithm>
 
 namespace lo2s
 {
@@ -32,12 +35,31 @@ namespace monitor
 ProcessMonitor::ProcessMonitor() : MainMonitor()
 {
     trace_.add_monitoring_thread(gettid(), "ProcessMonitor", "ProcessMonitor");
+
+    for (std::size_t i = 0; i < config().monitor_workers; i++)
+    {
+        workers_.emplace_back(std::make_unique<ScopeWorker>(*this, i));
+        workers_.back()->start();
+    }
 }
 
 void ProcessMonitor::insert_process(Process parent, Process process, std::string proc_name,
                                     bool spawn)
 {
     trace_.add_process(parent, process, proc_name);
+
+    // Processes created later on inherit the events of the first one
+    if (config().inherit && parent == trace::Trace::NO_PARENT_PROCESS)
+    {
+        for (const auto& cpu : Topology::instance().cpus())
+        {
+            auto inserted =
+                cpus_.emplace(std::piecewise_construct, std::forward_as_tuple(cpu),
+                              std::forward_as_tuple(cpu.as_scope(), *this, spawn, process));
+            inserted.first->second.start();
+        }
+    }
+
     insert_thread(process, process.as_thread(), proc_name, spawn);
 }
 
@@ -47,19 +69,32 @@ void ProcessMonitor::insert_thread(Process process, Thread thread, std::string n
 
     if (config().sampling)
     {
+        std::lock_guard<std::mutex> lock(process_infos_mutex_);
         process_infos_.try_emplace(process, process, spawn);
     }
 
-    if (config().sampling ||
-        perf::counter::CounterProvider::instance().has_group_counters(ExecutionScope(thread)) ||
-        perf::counter::CounterProvider::instance().has_userspace_counters(ExecutionScope(thread)))
+    if (!config().inherit &&
+        (config().sampling ||
+         perf::counter::CounterProvider::instance().has_group_counters(ExecutionScope(thread)) ||
+         perf::counter::CounterProvider::instance().has_userspace_counters(ExecutionScope(thread))))
     {
-        auto inserted =
-            threads_.emplace(std::piecewise_construct, std::forward_as_tuple(thread),
-                             std::forward_as_tuple(ExecutionScope(thread), *this, spawn));
-        assert(inserted.second);
-        // actually start thread
-        inserted.first->second.start();
+        if (!workers_.empty())
+        {
+            auto& worker = *std::min_element(
+                workers_.begin(), workers_.end(),
+                [](const auto& a, const auto& b) { return a->num_scopes() < b->num_scopes(); });
+            worker->insert_scope(ExecutionScope(thread), spawn);
+            worker_threads_.emplace(thread, worker.get());
+        }
+        else
+        {
+            auto inserted =
+                threads_.emplace(std::piecewise_construct, std::forward_as_tuple(thread),
+                                 std::forward_as_tuple(ExecutionScope(thread), *this, spawn));
+            assert(inserted.second);
+            // actually start thread
+            inserted.first->second.start();
+        }
     }
 
     trace_.update_thread_name(thread, name);
@@ -72,6 +107,14 @@ void ProcessMonitor::update_process_name(Process process, const std::string& nam
 
 void ProcessMonitor::exit_thread(Thread thread)
 {
+    auto worker = worker_threads_.find(thread);
+    if (worker != worker_threads_.end())
+    {
+        worker->second->remove_scope(ExecutionScope(thread));
+        worker_threads_.erase(worker);
+        return;
+    }
+
     if (threads_.count(thread) != 0)
     {
         threads_.at(thread).stop();
@@ -85,6 +128,16 @@ ProcessMonitor::~ProcessMonitor()
     {
         thread.second.stop();
     }
+
+    for (auto& cpu : cpus_)
+    {
+        cpu.second.stop();
+    }
+
+    for (auto& worker : workers_)
+    {
+        worker->stop();
+    }
 }
 } // namespace monitor
 } // namespace lo2s
@@ -42,39 +42,95 @@ namespace lo2s
 namespace monitor
 {
 
-ScopeMonitor::ScopeMonitor(ExecutionScope scope, MainMonitor& parent, bool enable_on_exec)
-: PollMonitor(parent.trace(), scope.name(), config().perf_read_interval), scope_(scope)
+// In flight recorder mode, the perf buffers are only read once, when the monitor is stopped.
+ScopeMonitor::ScopeMonitor(ExecutionScope scope, MainMonitor& parent, bool enable_on_exec,
+                           Process inherit_from)
+: PollMonitor(parent.trace(), scope.name(),
+              config().flight_recorder ? std::chrono::nanoseconds(0) : config().perf_read_interval),
+  scope_(scope)
 {
     if (config().sampling || scope.is_cpu())
     {
-        sample_writer_ =
-            std::make_unique<perf::sample::Writer>(scope, parent, parent.trace(), enable_on_exec);
-        add_fd(sample_writer_->fd());
+        sample_writer_ = std::make_unique<perf::sample::Writer>(scope, parent, parent.trace(),
+                                                                enable_on_exec, inherit_from);
+        sample_writer_->on_read(self_metrics("samples"));
+        add_perf_fd(sample_writer_->fd(), [this]() {
+            follow_scope();
+            sample_writer_->read();
+        });
+    }
+
+    // With --consolidate-buffers, the other events of this CPU write into the ring buffer of the
+    // sample writer, which hands their records back to them.
+    int output_fd = -1;
+    if (scope.is_cpu() && config().consolidate_buffers)
+    {
+        output_fd = sample_writer_->fd();
     }
 
     if (scope.is_cpu() && config().use_syscalls)
     {
-        syscall_writer_ = std::make_unique<perf::syscall::Writer>(scope.as_cpu(), parent.trace());
-        add_fd(syscall_writer_->fd());
+        syscall_writer_ =
+            std::make_unique<perf::syscall::Writer>(scope.as_cpu(), parent.trace(), output_fd);
+        if (output_fd != -1)
+        {
+            sample_writer_->demultiplex(*syscall_writer_);
+        }
+        else
+        {
+            syscall_writer_->on_read(self_metrics("syscalls"));
+            add_perf_fd(syscall_writer_->fd(), [this]() { syscall_writer_->read(); });
+        }
     }
 
     if (perf::counter::CounterProvider::instance().has_group_counters(scope))
     {
-        group_counter_writer_ =
-            std::make_unique<perf::counter::group::Writer>(scope, parent.trace(), enable_on_exec);
-        add_fd(group_counter_writer_->fd());
+        group_counter_writer_ = std::make_unique<perf::counter::group::Writer>(
+            scope, parent.trace(), enable_on_exec, output_fd);
+        if (output_fd != -1)
+        {
+            sample_writer_->demultiplex(*group_counter_writer_);
+        }
+        else
+        {
+            group_counter_writer_->on_read(self_metrics("metrics"));
+            add_perf_fd(group_counter_writer_->fd(), [this]() {
+                follow_scope();
+                group_counter_writer_->read();
+            });
+        }
     }
 
     if (perf::counter::CounterProvider::instance().has_userspace_counters(scope))
     {
         userspace_counter_writer_ =
             std::make_unique<perf::counter::userspace::Writer>(scope, parent.trace());
-        add_fd(userspace_counter_writer_->fd());
+        add_fd(userspace_counter_writer_->fd(), [this]() {
+            follow_scope();
+            userspace_counter_writer_->read();
+        });
     }
 
     // note: start() can now be called
 }
 
+void ScopeMonitor::add_perf_fd(int fd, std::function<void()> handler)
+{
+    if (!config().flight_recorder)
+    {
+        add_fd(fd, std::move(handler));
+    }
+}
+
+// Monitors of a thread move along with it, to read its buffers where it is running
+void ScopeMonitor::follow_scope()
+{
+    if (!scope_.is_cpu())
+    {
+        try_pin_to_scope(scope_);
+    }
+}
+
 void ScopeMonitor::initialize_thread()
 {
     try_pin_to_scope(scope_);
@@ -88,31 +144,25 @@ void ScopeMonitor::finalize_thread()
     }
 }
 
-void ScopeMonitor::monitor(int fd)
+// Only called for the timer and on stop, the writers' own fds have dedicated handlers
+void ScopeMonitor::monitor([[maybe_unused]] int fd)
 {
-    if (!scope_.is_cpu())
-    {
-        try_pin_to_scope(scope_);
-    }
+    follow_scope();
 
-    if (syscall_writer_ &&
-        (fd == timer_pfd().fd || fd == stop_pfd().fd || syscall_writer_->fd() == fd))
+    if (syscall_writer_)
     {
         syscall_writer_->read();
     }
-    if (sample_writer_ &&
-        (fd == timer_pfd().fd || fd == stop_pfd().fd || sample_writer_->fd() == fd))
+    if (sample_writer_)
     {
         sample_writer_->read();
     }
 
-    if (group_counter_writer_ &&
-        (fd == timer_pfd().fd || fd == stop_pfd().fd || group_counter_writer_->fd() == fd))
+    if (group_counter_writer_)
     {
         group_counter_writer_->read();
     }
-    if (userspace_counter_writer_ &&
-        (fd == timer_pfd().fd || fd == stop_pfd().fd || userspace_counter_writer_->fd() == fd))
+    if (userspace_counter_writer_)
     {
         userspace_counter_writer_->read();
     }
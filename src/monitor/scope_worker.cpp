@@ -0,0 +1,210 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <lo2s/monitor/scope_worker.hpp>
+
+#include <lo2s/config.hpp>
+#include <lo2s/log.hpp>
+#include <lo2s/perf/counter/counter_provider.hpp>
+
+#include <fmt/core.h>
+
+#include <string>
+
+namespace lo2s
+{
+namespace monitor
+{
+
+ScopeWorker::ScopeWorker(MainMonitor& parent, std::size_t id)
+: PollMonitor(parent.trace(), std::to_string(id), config().perf_read_interval), parent_(parent)
+{
+    // Every request writes one byte to the pipe. Bytes left over from requests that were already
+    // handled in an earlier batch just cause a spurious wakeup.
+    add_fd(requests_pipe_.read_fd(), [this]() {
+        requests_pipe_.read();
+        handle_requests();
+    });
+}
+
+void ScopeWorker::Writers::read()
+{
+    if (sample_writer)
+    {
+        sample_writer->read();
+    }
+    if (group_counter_writer)
+    {
+        group_counter_writer->read();
+    }
+    if (userspace_counter_writer)
+    {
+        userspace_counter_writer->read();
+    }
+}
+
+void ScopeWorker::insert_scope(ExecutionScope scope, bool enable_on_exec)
+{
+    auto writers = std::make_unique<Writers>();
+
+    if (config().sampling)
+    {
+        writers->sample_writer = std::make_unique<perf::sample::Writer>(scope, parent_, trace_,
+                                                                        enable_on_exec);
+        writers->sample_writer->on_read(self_metrics(fmt::format("{} samples", scope.name())));
+    }
+
+    if (perf::counter::CounterProvider::instance().has_group_counters(scope))
+    {
+        writers->group_counter_writer =
+            std::make_unique<perf::counter::group::Writer>(scope, trace_, enable_on_exec);
+        writers->group_counter_writer->on_read(
+            self_metrics(fmt::format("{} metrics", scope.name())));
+    }
+
+    if (perf::counter::CounterProvider::instance().has_userspace_counters(scope))
+    {
+        writers->userspace_counter_writer =
+            std::make_unique<perf::counter::userspace::Writer>(scope, trace_);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(requests_mutex_);
+        pending_inserts_.emplace_back(scope, std::move(writers));
+    }
+    num_scopes_++;
+    requests_pipe_.write();
+}
+
+void ScopeWorker::remove_scope(ExecutionScope scope)
+{
+    {
+        std::lock_guard<std::mutex> lock(requests_mutex_);
+        pending_removals_.emplace_back(scope);
+    }
+    requests_pipe_.write();
+}
+
+void ScopeWorker::handle_requests()
+{
+    std::vector<std::pair<ExecutionScope, std::unique_ptr<Writers>>> inserts;
+    std::vector<ExecutionScope> removals;
+    {
+        std::lock_guard<std::mutex> lock(requests_mutex_);
+        std::swap(inserts, pending_inserts_);
+        std::swap(removals, pending_removals_);
+    }
+
+    // A scope may be inserted and removed within the same batch, so insert first
+    for (auto& insert : inserts)
+    {
+        register_scope(insert.first, std::move(insert.second));
+    }
+    for (auto& scope : removals)
+    {
+        unregister_scope(scope);
+    }
+}
+
+void ScopeWorker::register_scope(ExecutionScope scope, std::unique_ptr<Writers> writers)
+{
+    auto* w = writers.get();
+    if (w->sample_writer)
+    {
+        add_fd(w->sample_writer->fd(), [w]() { w->sample_writer->read(); });
+    }
+    if (w->group_counter_writer)
+    {
+        add_fd(w->group_counter_writer->fd(), [w]() { w->group_counter_writer->read(); });
+    }
+    if (w->userspace_counter_writer)
+    {
+        add_fd(w->userspace_counter_writer->fd(), [w]() { w->userspace_counter_writer->read(); });
+    }
+
+    scopes_.emplace(scope, std::move(writers));
+}
+
+void ScopeWorker::unregister_scope(ExecutionScope scope)
+{
+    auto it = scopes_.find(scope);
+    if (it == scopes_.end())
+    {
+        Log::warn() << "ScopeWorker asked to remove unknown scope " << scope.name();
+        return;
+    }
+
+    auto& writers = *it->second;
+    writers.read();
+
+    if (writers.sample_writer)
+    {
+        writers.sample_writer->end();
+        remove_fd(writers.sample_writer->fd());
+    }
+    if (writers.group_counter_writer)
+    {
+        remove_fd(writers.group_counter_writer->fd());
+    }
+    if (writers.userspace_counter_writer)
+    {
+        remove_fd(writers.userspace_counter_writer->fd());
+    }
+
+    scopes_.erase(it);
+    num_scopes_--;
+}
+
+// Timer and stop, read everything
+void ScopeWorker::monitor(int fd)
+{
+    if (fd == stop_fd())
+    {
+        handle_requests();
+    }
+
+    for (auto& scope : scopes_)
+    {
+        scope.second->read();
+    }
+}
+
+bool ScopeWorker::unexpected_event(int fd, [[maybe_unused]] uint32_t events)
+{
+    // The perf events of a thread hang up once it has exited. What is left in the buffers is read
+    // when the ProcessMonitor removes the scope.
+    remove_fd(fd);
+    return true;
+}
+
+void ScopeWorker::finalize_thread()
+{
+    for (auto& scope : scopes_)
+    {
+        if (scope.second->sample_writer)
+        {
+            scope.second->sample_writer->end();
+        }
+    }
+    scopes_.clear();
+}
+} // namespace monitor
+} // namespace lo2s
@@ -36,14 +36,30 @@ namespace monitor
 TracepointMonitor::TracepointMonitor(trace::Trace& trace, Cpu cpu)
 : monitor::PollMonitor(trace, "", config().perf_read_interval), cpu_(cpu)
 {
+    // With --consolidate-buffers, all tracepoints of this CPU share the ring buffer of the first
+    perf::tracepoint::Writer* output = nullptr;
+
     for (const auto& event_name : config().tracepoint_events)
     {
         auto& mc = trace.tracepoint_metric_class(event_name);
         perf::tracepoint::EventFormat event(event_name);
         std::unique_ptr<perf::tracepoint::Writer> writer =
-            std::make_unique<perf::tracepoint::Writer>(cpu, event, trace, mc);
+            std::make_unique<perf::tracepoint::Writer>(cpu, event, trace, mc,
+                                                       output != nullptr ? output->fd() : -1);
 
-        add_fd(writer->fd());
+        if (output != nullptr)
+        {
+            output->demultiplex(*writer);
+        }
+        else
+        {
+            writer->on_read(self_metrics(event_name));
+            add_fd(writer->fd(), [w = writer.get()]() { w->read(); });
+            if (config().consolidate_buffers)
+            {
+                output = writer.get();
+            }
+        }
         perf_writers_.emplace(std::piecewise_construct, std::forward_as_tuple(writer->fd()),
                               std::forward_as_tuple(std::move(writer)));
     }
@@ -54,19 +70,13 @@ void TracepointMonitor::initialize_thread()
 }
 void TracepointMonitor::monitor(int fd)
 {
-    if (fd == timer_pfd().fd)
-    {
-        return;
-    }
-    else if (fd == stop_pfd().fd)
+    if (fd == stop_fd())
     {
         for (auto& perf_writer : perf_writers_)
         {
             perf_writer.second->read();
         }
-        return;
     }
-    perf_writers_.at(fd)->read();
 }
 
 void TracepointMonitor::finalize_thread()
@@ -48,7 +48,7 @@ namespace group
 {
 
 template <class T>
-Reader<T>::Reader(ExecutionScope scope, bool enable_on_exec)
+Reader<T>::Reader(ExecutionScope scope, bool enable_on_exec, int output_fd)
 : counter_collection_(
       CounterProvider::instance().collection_for(MeasurementScope::group_metric(scope))),
   counter_buffer_(counter_collection_.counters.size() + 1)
@@ -59,7 +59,7 @@ Reader<T>::Reader(ExecutionScope scope, bool enable_on_exec)
     leader_attr.config = counter_collection_.leader.config;
     leader_attr.config1 = counter_collection_.leader.config1;
 
-    leader_attr.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_READ;
+    leader_attr.sample_type = PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_TIME | PERF_SAMPLE_READ;
     leader_attr.freq = config().metric_use_frequency;
 
     if (leader_attr.freq)
@@ -78,6 +78,9 @@ Reader<T>::Reader(ExecutionScope scope, bool enable_on_exec)
     leader_attr.read_format =
         PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING | PERF_FORMAT_GROUP;
     leader_attr.enable_on_exec = enable_on_exec;
+#ifdef HAVE_PERF_WRITE_BACKWARD
+    leader_attr.write_backward = config().flight_recorder;
+#endif
 
     group_leader_fd_ = perf_try_event_open(&leader_attr, scope, -1, 0, config().cgroup_fd);
     if (group_leader_fd_ < 0)
@@ -125,7 +128,15 @@ Reader<T>::Reader(ExecutionScope scope, bool enable_on_exec)
             throw_errno();
         }
     }
-    EventReader<T>::init_mmap(group_leader_fd_);
+
+    if (output_fd != -1)
+    {
+        EventReader<T>::init_output(group_leader_fd_, output_fd);
+    }
+    else
+    {
+        EventReader<T>::init_mmap(group_leader_fd_, config().flight_recorder);
+    }
 }
 template class Reader<Writer>;
 } // namespace group
@@ -31,8 +31,9 @@ namespace counter
 {
 namespace group
 {
-Writer::Writer(ExecutionScope scope, trace::Trace& trace, bool enable_on_exec)
-: Reader(scope, enable_on_exec), MetricWriter(MeasurementScope::group_metric(scope), trace)
+Writer::Writer(ExecutionScope scope, trace::Trace& trace, bool enable_on_exec, int output_fd)
+: Reader(scope, enable_on_exec, output_fd),
+  MetricWriter(MeasurementScope::group_metric(scope), trace)
 {
 }
 
@@ -34,6 +34,7 @@
 #include <lo2s/process_info.hpp>
 #include <lo2s/time/time.hpp>
 #include <lo2s/trace/trace.hpp>
+#include <lo2s/util.hpp>
 
 #include <otf2xx/otf2.hpp>
 
@@ -53,51 +54,168 @@ namespace sample
 {
 
 Writer::Writer(ExecutionScope scope, monitor::MainMonitor& Monitor, trace::Trace& trace,
-               bool enable_on_exec)
-: Reader(scope, enable_on_exec), scope_(scope), monitor_(Monitor), trace_(trace),
+               bool enable_on_exec, Process inherit_from)
+: Reader(scope, enable_on_exec, inherit_from), scope_(scope), monitor_(Monitor), trace_(trace),
   otf2_writer_(trace.sample_writer(scope)),
   cpuid_metric_instance_(trace.metric_instance(trace.cpuid_metric_class(), otf2_writer_.location(),
                                                otf2_writer_.location())),
   cpuid_metric_event_(otf2::chrono::genesis(), cpuid_metric_instance_), cctx_manager_(trace),
   time_converter_(perf::time::Converter::instance()), first_time_point_(lo2s::time::now()),
-  last_time_point_(first_time_point_)
+  last_time_point_(first_time_point_), last_cctx_flush_(first_time_point_),
+  reorder_buffer_(config().reorder_window)
 {
+    if (config().profile_window.count() != 0)
+    {
+        profile_metric_event_.emplace(
+            otf2::chrono::genesis(),
+            trace.metric_instance(trace.profile_metric_class(), otf2_writer_.location(),
+                                  otf2_writer_.location()));
+    }
 }
 
 Writer::~Writer()
 {
+    drain_reorder_buffer();
+
     if (!cctx_manager_.current().is_undefined())
     {
+        write_profile();
         otf2_writer_.write_calling_context_leave(adjust_timepoints(lo2s::time::now()),
                                                  cctx_manager_.current());
     }
 
     cctx_manager_.finalize(&otf2_writer_);
+    summary().record_timestamp_order(reorder_buffer_.reordered(), clamped_timestamps_);
 }
 
 bool Writer::handle(const Reader::RecordSampleType* sample)
+{
+    if (reorder_buffer_.enabled())
+    {
+        reorder(sample->time, &sample->header);
+    }
+    else
+    {
+        write_sample(sample);
+    }
+    return false;
+}
+
+void Writer::reorder(uint64_t time, const perf_event_header* record)
+{
+    reorder_buffer_.push(time, record,
+                         [this](const perf_event_header* ordered) { write_ordered(ordered); });
+}
+
+void Writer::drain_reorder_buffer()
+{
+    reorder_buffer_.drain([this](const perf_event_header* ordered) { write_ordered(ordered); });
+}
+
+void Writer::write_ordered(const perf_event_header* record)
+{
+    switch (record->type)
+    {
+    case PERF_RECORD_SAMPLE:
+        write_sample(reinterpret_cast<const Reader::RecordSampleType*>(record));
+        break;
+    case PERF_RECORD_SWITCH:
+        write_switch(reinterpret_cast<const Reader::RecordSwitchType*>(record));
+        break;
+    case PERF_RECORD_SWITCH_CPU_WIDE:
+        write_switch_cpu_wide(reinterpret_cast<const Reader::RecordSwitchCpuWideType*>(record));
+        break;
+    default:
+        assert(false);
+    }
+}
+
+void Writer::write_sample(const Reader::RecordSampleType* sample)
 {
     auto tp = time_converter_(sample->time);
     tp = adjust_timepoints(tp);
 
     update_current_thread(Process(sample->pid), Thread(sample->tid), tp);
 
-    cpuid_metric_event_.timestamp(tp);
-    cpuid_metric_event_.raw_values()[0] = sample->cpu;
-    otf2_writer_ << cpuid_metric_event_;
+    if (profile_metric_event_)
+    {
+        if (tp >= profile_window_end_)
+        {
+            write_profile();
+            profile_window_end_ = tp + config().profile_window;
+        }
 
-    if (!has_cct_)
+        auto [ref, unwind_distance] = sample_ref(sample);
+        auto& entry =
+            profile_.try_emplace(ref, ProfileEntry{ 0, unwind_distance }).first->second;
+        entry.count++;
+        last_sample_time_point_ = tp;
+    }
+    else
     {
-        otf2_writer_.write_calling_context_sample(tp, cctx_manager_.sample_ref(sample->ip), 2,
+        write_cpuid(tp, sample->cpu);
+
+        auto [ref, unwind_distance] = sample_ref(sample);
+        otf2_writer_.write_calling_context_sample(tp, ref, unwind_distance,
                                                   trace_.interrupt_generator().ref());
     }
-    else
+
+    if (config().cctx_merge_interval.count() != 0 &&
+        tp - last_cctx_flush_ >= config().cctx_merge_interval)
     {
-        otf2_writer_.write_calling_context_sample(tp,
-                                                  cctx_manager_.sample_ref(sample->nr, sample->ips),
-                                                  sample->nr, trace_.interrupt_generator().ref());
+        flush_calling_contexts(tp);
     }
-    return false;
+}
+
+CallingContextManager::SampleRef Writer::sample_ref(const Reader::RecordSampleType* sample)
+{
+    if (config().dwarf_unwind)
+    {
+        return cctx_manager_.sample_ref(sample->nr, sample->ips, user_stack(sample));
+    }
+    if (has_cct_)
+    {
+        return cctx_manager_.sample_ref(sample->nr, sample->ips);
+    }
+    return cctx_manager_.sample_ref(sample->ip);
+}
+
+void Writer::write_cpuid(otf2::chrono::time_point tp, int64_t cpu)
+{
+    cpuid_filter_.value(0, cpu);
+    if (cpuid_filter_.should_write())
+    {
+        cpuid_metric_event_.timestamp(tp);
+        cpuid_metric_event_.raw_values()[0] = cpu;
+        otf2_writer_ << cpuid_metric_event_;
+    }
+}
+
+// Writes one calling context sample per sampled calling context, at the time of the last sample, so
+// that all of them are within the enter/leave of the current thread.
+void Writer::write_profile()
+{
+    for (const auto& [ref, entry] : profile_)
+    {
+        otf2_writer_.write_calling_context_sample(last_sample_time_point_, ref,
+                                                  entry.unwind_distance,
+                                                  trace_.interrupt_generator().ref());
+
+        profile_metric_event_->timestamp(last_sample_time_point_);
+        profile_metric_event_->raw_values()[0] = entry.count;
+        otf2_writer_ << *profile_metric_event_;
+    }
+    profile_.clear();
+}
+
+void Writer::flush_calling_contexts(otf2::chrono::time_point tp)
+{
+    // The memory maps must be known before the handed off calling contexts can be resolved
+    monitor_.insert_cached_mmap_events(cached_mmap_events_);
+    cached_mmap_events_.clear();
+
+    cctx_manager_.flush();
+    last_cctx_flush_ = tp;
 }
 
 bool Writer::handle(const Reader::RecordMmapType* mmap_event)
@@ -137,6 +255,7 @@ void Writer::update_current_thread(Process process, Thread thread, otf2::chrono:
 }
 void Writer::leave_current_thread(Thread thread, otf2::chrono::time_point tp)
 {
+    write_profile();
     otf2_writer_.write_calling_context_leave(tp, cctx_manager_.current());
     cctx_manager_.thread_leave(thread);
 }
@@ -146,9 +265,10 @@ otf2::chrono::time_point Writer::adjust_timepoints(otf2::chrono::time_point tp)
     // as the perf timepoints can not be trusted to be in order all the time fix them here
     if (last_time_point_ > tp)
     {
-        Log::debug() << "perf_event_open timestamps not in order: " << last_time_point_ << ">"
-                     << tp;
+        LO2S_HOT_LOG(debug) << "perf_event_open timestamps not in order: " << last_time_point_
+                            << ">" << tp;
         tp = last_time_point_;
+        clamped_timestamps_++;
     }
     last_time_point_ = tp;
     return tp;
@@ -157,38 +277,61 @@ otf2::chrono::time_point Writer::adjust_timepoints(otf2::chrono::time_point tp)
 bool Writer::handle(const Reader::RecordSwitchCpuWideType* context_switch)
 {
     assert(scope_.is_cpu());
+    if (reorder_buffer_.enabled())
+    {
+        reorder(context_switch->time, &context_switch->header);
+    }
+    else
+    {
+        write_switch_cpu_wide(context_switch);
+    }
+    return false;
+}
+
+void Writer::write_switch_cpu_wide(const Reader::RecordSwitchCpuWideType* context_switch)
+{
     auto tp = time_converter_(context_switch->time);
     tp = adjust_timepoints(tp);
 
     update_calling_context(Process(context_switch->pid), Thread(context_switch->tid), tp,
                            context_switch->header.misc & PERF_RECORD_MISC_SWITCH_OUT);
+}
 
+// Also delivered to CPU scopes that only sample one process with --inherit
+bool Writer::handle(const Reader::RecordSwitchType* context_switch)
+{
+    if (reorder_buffer_.enabled())
+    {
+        reorder(context_switch->time, &context_switch->header);
+    }
+    else
+    {
+        write_switch(context_switch);
+    }
     return false;
 }
 
-bool Writer::handle(const Reader::RecordSwitchType* context_switch)
+void Writer::write_switch(const Reader::RecordSwitchType* context_switch)
 {
-    assert(!scope_.is_cpu());
     auto tp = time_converter_(context_switch->time);
     tp = adjust_timepoints(tp);
 
     update_calling_context(Process(context_switch->pid), Thread(context_switch->tid), tp,
                            context_switch->header.misc & PERF_RECORD_MISC_SWITCH_OUT);
 
+    if (scope_.is_cpu())
+    {
+        return;
+    }
+
     if (context_switch->header.misc & PERF_RECORD_MISC_SWITCH_OUT)
     {
-        cpuid_metric_event_.timestamp(tp);
-        cpuid_metric_event_.raw_values()[0] = -1;
-        otf2_writer_ << cpuid_metric_event_;
+        write_cpuid(tp, -1);
     }
     else
     {
-        cpuid_metric_event_.timestamp(tp);
-        cpuid_metric_event_.raw_values()[0] = context_switch->cpu;
-        otf2_writer_ << cpuid_metric_event_;
+        write_cpuid(tp, context_switch->cpu);
     }
-
-    return false;
 }
 
 void Writer::update_calling_context(Process process, Thread thread, otf2::chrono::time_point tp,
@@ -234,8 +377,38 @@ bool Writer::handle(const Reader::RecordCommType* comm)
     return false;
 }
 
+// With --inherit, threads created in the monitored process are not reported through ptrace, so
+// register them here, under the name they inherited from their creator.
+bool Writer::handle(const Reader::RecordForkType* fork)
+{
+    // New processes are still reported through ptrace
+    if (!config().inherit || fork->pid != fork->ppid || fork->tid == fork->ptid)
+    {
+        return false;
+    }
+
+    Thread thread(fork->tid);
+    if (comms_.count(thread) == 0)
+    {
+        auto parent = comms_.find(Thread(fork->ptid));
+        if (parent != comms_.end())
+        {
+            comms_.emplace(thread, parent->second);
+        }
+        else
+        {
+            comms_.emplace(thread, get_task_comm(Process(fork->pid), thread));
+        }
+    }
+    summary().add_thread();
+
+    return false;
+}
+
 void Writer::end()
 {
+    drain_reorder_buffer();
+
     if (!scope_.is_cpu())
     {
         adjust_timepoints(lo2s::time::now());
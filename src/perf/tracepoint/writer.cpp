@@ -15,8 +15,8 @@ namespace tracepoint
 {
 
 Writer::Writer(Cpu cpu, const EventFormat& event, trace::Trace& trace_,
-               const otf2::definition::metric_class& metric_class)
-: Reader(cpu, event.id()), event_(event),
+               const otf2::definition::metric_class& metric_class, int output_fd)
+: Reader(cpu, event.id(), output_fd), event_(event),
   writer_(trace_.create_metric_writer(fmt::format("tracepoint metrics for {}", cpu))),
   metric_instance_(
       trace_.metric_instance(metric_class, writer_.location(), trace_.system_tree_cpu_node(cpu))),
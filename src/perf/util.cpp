@@ -49,6 +49,13 @@ int perf_event_open(struct perf_event_attr* perf_attr, ExecutionScope scope, int
     return syscall(__NR_perf_event_open, perf_attr, pid, cpuid, group_fd, flags);
 }
 
+int perf_event_open(struct perf_event_attr* perf_attr, Cpu cpu, Process process, int group_fd,
+                    unsigned long flags)
+{
+    return syscall(__NR_perf_event_open, perf_attr, process.as_pid_t(), cpu.as_int(), group_fd,
+                   flags);
+}
+
 // Default options we use in every perf_event_open call
 struct perf_event_attr common_perf_event_attrs()
 {
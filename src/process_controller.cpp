@@ -21,6 +21,7 @@
 
 #include <lo2s/process_controller.hpp>
 
+#include <lo2s/config.hpp>
 #include <lo2s/error.hpp>
 #include <lo2s/log.hpp>
 #include <lo2s/summary.hpp>
@@ -281,9 +282,15 @@ ProcessController::SignalHandlingState ProcessController::handle_signal(Thread c
             Log::debug() << "Set ptrace options for " << child;
 
             // we are only interested in fork/join events
-            ptrace_setoptions(child, PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
-                                         PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXIT |
-                                         PTRACE_O_TRACEEXEC);
+            long options = PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXIT |
+                           PTRACE_O_TRACEEXEC;
+            // With --inherit, new threads are covered by the perf events of their process, so
+            // there is no need to stop them
+            if (!config().inherit)
+            {
+                options |= PTRACE_O_TRACECLONE;
+            }
+            ptrace_setoptions(child, options);
             // FIXME TODO continue this new thread/process ONLY if already registered in the
             // thread map.
             break;
@@ -0,0 +1,51 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <lo2s/self_metrics.hpp>
+
+#include <lo2s/time/time.hpp>
+#include <lo2s/trace/trace.hpp>
+
+#include <fmt/core.h>
+
+namespace lo2s
+{
+
+SelfMetrics::SelfMetrics(trace::Trace& trace, const std::string& name)
+: writer_(trace.create_metric_writer(fmt::format("lo2s self metrics for {}", name))),
+  metric_instance_(
+      trace.metric_instance(trace.self_metric_class(), writer_.location(), writer_.location())),
+  event_(otf2::chrono::genesis(), metric_instance_)
+{
+}
+
+void SelfMetrics::write(const perf::ReadStats& stats)
+{
+    event_.timestamp(time::now());
+    event_.raw_values()[0] = stats.records;
+    event_.raw_values()[1] = stats.bytes;
+    event_.raw_values()[2] = stats.fill_percent;
+    event_.raw_values()[3] = stats.duration.count();
+    event_.raw_values()[4] = stats.lost;
+    event_.raw_values()[5] = stats.throttled;
+    writer_.write(event_);
+}
+} // namespace lo2s
@@ -0,0 +1,68 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/string_pool.hpp>
+
+#include <mutex>
+
+namespace lo2s
+{
+
+StringPool::~StringPool()
+{
+    for (auto& chunk : chunks_)
+    {
+        delete[] chunk.load();
+    }
+}
+
+StringPool::Id StringPool::intern(std::string_view str)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        if (auto it = ids_.find(str); it != ids_.end())
+        {
+            return it->second;
+        }
+    }
+
+    std::lock_guard<std::shared_mutex> lock(mutex_);
+    // Someone else might have been faster
+    if (auto it = ids_.find(str); it != ids_.end())
+    {
+        return it->second;
+    }
+
+    Id id = next_id_++;
+    auto [chunk, index] = locate(id);
+    auto* strings = chunks_[chunk].load(std::memory_order_relaxed);
+    if (strings == nullptr)
+    {
+        strings = new std::string[chunk_size(chunk)];
+        chunks_[chunk].store(strings, std::memory_order_release);
+    }
+
+    strings[index] = str;
+    ids_.emplace(strings[index], id);
+    return id;
+}
+} // namespace lo2s
@@ -13,6 +13,7 @@
 
 extern "C"
 {
+#include <sys/resource.h>
 #include <sys/time.h>
 }
 
@@ -27,7 +28,8 @@ Summary& summary()
 
 Summary::Summary()
 : start_wall_time_(std::chrono::steady_clock::now()), num_wakeups_(0), thread_count_(0),
-  exit_code_(0)
+  callchain_cache_hits_(0), callchain_cache_lookups_(0), reordered_timestamps_(0),
+  clamped_timestamps_(0), exit_code_(0)
 {
 }
 
@@ -42,6 +44,24 @@ void Summary::record_perf_wakeups(std::size_t num_wakeups)
     num_wakeups_ += num_wakeups;
 }
 
+void Summary::record_read_stats(const perf::ReadStats& stats)
+{
+    std::lock_guard<std::mutex> lock(read_stats_mutex_);
+    read_stats_ += stats;
+}
+
+void Summary::record_callchain_cache(std::size_t hits, std::size_t lookups)
+{
+    callchain_cache_hits_ += hits;
+    callchain_cache_lookups_ += lookups;
+}
+
+void Summary::record_timestamp_order(std::size_t reordered, std::size_t clamped)
+{
+    reordered_timestamps_ += reordered;
+    clamped_timestamps_ += clamped;
+}
+
 void Summary::set_exit_code(int exit_code)
 {
     exit_code_ = exit_code;
@@ -142,11 +162,62 @@ void Summary::show()
     }
     std::cout << num_wakeups_ << " wakeups, ";
 
+    if (callchain_cache_lookups_ > 0)
+    {
+        std::ostringstream hit_rate;
+        hit_rate << std::fixed << std::setprecision(1)
+                 << 100.0 * callchain_cache_hits_ / callchain_cache_lookups_;
+        std::cout << "callchain cache hit rate " << hit_rate.str() << "%, ";
+    }
+
+    if (reordered_timestamps_ > 0 || clamped_timestamps_ > 0)
+    {
+        std::cout << reordered_timestamps_ << " timestamps reordered, " << clamped_timestamps_
+                  << " clamped, ";
+    }
+
     if (trace_dir_ != "")
     {
         std::cout << "wrote " << pretty_print_bytes(trace_size) << " " << trace_dir_;
     }
 
     std::cout << " ]\n";
+
+    if (config().self_metrics)
+    {
+        std::chrono::duration<double> read_time = read_stats_.duration;
+
+        std::cout << "[ lo2s self metrics:\n";
+        std::cout << std::left;
+        std::cout << "    " << std::setw(24) << "records read" << read_stats_.records << '\n';
+        std::cout << "    " << std::setw(24) << "data read" << pretty_print_bytes(read_stats_.bytes)
+                  << '\n';
+        std::cout << "    " << std::setw(24) << "time spent reading" << read_time.count() << "s\n";
+        std::cout << "    " << std::setw(24) << "records lost" << read_stats_.lost << '\n';
+        std::cout << "    " << std::setw(24) << "throttle events" << read_stats_.throttled << '\n';
+        std::cout << "    " << std::setw(24) << "peak buffer fill" << read_stats_.fill_percent
+                  << "%\n";
+        std::cout << "    " << std::setw(24) << "wakeups" << num_wakeups_ << '\n';
+
+        // cpu_time includes the monitored command, so look at lo2s itself here
+        struct rusage usage, child_usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0 && getrusage(RUSAGE_CHILDREN, &child_usage) == 0)
+        {
+            timeval self_time, child_time;
+            timeradd(&usage.ru_utime, &usage.ru_stime, &self_time);
+            timeradd(&child_usage.ru_utime, &child_usage.ru_stime, &child_time);
+            double self_seconds = self_time.tv_sec + self_time.tv_usec / 1e6;
+            double child_seconds = child_time.tv_sec + child_time.tv_usec / 1e6;
+
+            std::cout << "    " << std::setw(24) << "lo2s CPU time" << self_seconds << "s";
+            if (child_seconds > 0)
+            {
+                std::cout << " (" << std::fixed << std::setprecision(2)
+                          << 100 * self_seconds / child_seconds << "% of the monitored command)";
+            }
+            std::cout << '\n';
+        }
+        std::cout << " ]\n";
+    }
 }
 } // namespace lo2s
@@ -0,0 +1,178 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/config.hpp>
+#include <lo2s/log.hpp>
+#include <lo2s/symbol_cache.hpp>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+#include <cerrno>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace lo2s
+{
+namespace elfr
+{
+
+SymbolCache::SymbolCache() : max_size_(config().symbol_cache_size)
+{
+    if (config().symbol_cache_dir.empty())
+    {
+        return;
+    }
+
+    std::filesystem::path dir = config().symbol_cache_dir;
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec)
+    {
+        Log::warn() << "could not create symbol cache directory " << dir << ": " << ec.message();
+        return;
+    }
+
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        std::error_code size_ec;
+        auto size = entry.file_size(size_ec);
+        if (!size_ec)
+        {
+            used_ += size;
+        }
+    }
+    if (ec)
+    {
+        Log::warn() << "could not read symbol cache directory " << dir << ": " << ec.message();
+        return;
+    }
+
+    dir_ = dir;
+    Log::debug() << "using symbol cache " << dir_ << " with " << used_ / 1024 << " KiB in use";
+}
+
+std::filesystem::path SymbolCache::find(const std::string& key)
+{
+    auto path = dir_ / (key + ".sym");
+    // The modification time doubles as the time of last use for eviction
+    if (utimensat(AT_FDCWD, path.c_str(), nullptr, 0) == -1)
+    {
+        return {};
+    }
+    return path;
+}
+
+void SymbolCache::store(const std::string& key, const char* data, std::size_t size)
+{
+    auto path = dir_ / (key + ".sym");
+    auto tmp = dir_ / fmt::format(".{}.{}.{}.tmp", key, getpid(), next_tmp_++);
+
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        Log::debug() << "could not create " << tmp << " in symbol cache";
+        return;
+    }
+
+    std::size_t written = 0;
+    while (written < size)
+    {
+        auto ret = write(fd, data + written, size - written);
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        written += ret;
+    }
+    close(fd);
+
+    // rename() is atomic, so concurrent readers either see the old image or the complete new one
+    if (written != size || rename(tmp.c_str(), path.c_str()) == -1)
+    {
+        Log::debug() << "could not write " << path << " to symbol cache";
+        unlink(tmp.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_ += size;
+    if (used_ > max_size_)
+    {
+        evict();
+    }
+}
+
+void SymbolCache::evict()
+{
+    // Other lo2s processes may have added or removed images as well, so recount everything
+    std::vector<std::tuple<std::filesystem::file_time_type, std::uintmax_t,
+                           std::filesystem::path>>
+        entries;
+    used_ = 0;
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir_, ec))
+    {
+        std::error_code entry_ec;
+        auto size = entry.file_size(entry_ec);
+        auto time = entry.last_write_time(entry_ec);
+        if (entry_ec)
+        {
+            continue;
+        }
+        entries.emplace_back(time, size, entry.path());
+        used_ += size;
+    }
+
+    std::sort(entries.begin(), entries.end());
+
+    std::size_t removed = 0;
+    for (const auto& [time, size, path] : entries)
+    {
+        if (used_ <= max_size_)
+        {
+            break;
+        }
+        if (std::filesystem::remove(path, ec))
+        {
+            used_ -= size;
+            removed++;
+        }
+    }
+    Log::debug() << "evicted " << removed << " images from the symbol cache";
+}
+} // namespace elfr
+} // namespace lo2s
@@ -0,0 +1,393 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/log.hpp>
+#include <lo2s/symbolize/definitions.hpp>
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+extern "C"
+{
+#include <otf2/otf2.h>
+}
+
+namespace lo2s
+{
+namespace symbolize
+{
+
+namespace
+{
+void check(OTF2_ErrorCode code, const std::string& what)
+{
+    if (code != OTF2_SUCCESS)
+    {
+        throw std::runtime_error(what + ": " + OTF2_Error_GetDescription(code));
+    }
+}
+
+class DefinitionRewriter
+{
+public:
+    DefinitionRewriter(const std::vector<ResolvedSymbol>& symbols)
+    {
+        // The first region (by reference) that resolves to a function represents all of them
+        std::map<LineInfo, uint32_t> canonical;
+        for (const auto& symbol : symbols)
+        {
+            regions_.emplace(symbol.region, &symbol.line_info);
+            scls_.emplace(symbol.scl, &symbol.line_info);
+        }
+        for (const auto& [region, line_info] : regions_)
+        {
+            auto it = canonical.emplace(*line_info, region).first;
+            if (it->second != region)
+            {
+                region_remap_.emplace(region, it->second);
+            }
+        }
+    }
+
+    // The new function and file names need references that are not used yet
+    void assign_strings()
+    {
+        for (const auto& [region, line_info] : regions_)
+        {
+            add_string(line_info->function());
+            add_string(line_info->file());
+        }
+    }
+
+    void set_writer(OTF2_GlobalDefWriter* writer)
+    {
+        writer_ = writer;
+    }
+
+    void finish()
+    {
+        write_new_strings();
+        check(error_, "writing definitions failed");
+    }
+
+    static OTF2_CallbackCode count_string(void* user_data, OTF2_StringRef self, const char*)
+    {
+        auto& rewriter = *static_cast<DefinitionRewriter*>(user_data);
+        rewriter.next_string_ = std::max(rewriter.next_string_, self + 1);
+        return OTF2_CALLBACK_SUCCESS;
+    }
+
+    static OTF2_CallbackCode region(void* user_data, OTF2_RegionRef self, OTF2_StringRef name,
+                                    OTF2_StringRef canonical_name, OTF2_StringRef description,
+                                    OTF2_RegionRole role, OTF2_Paradigm paradigm,
+                                    OTF2_RegionFlag flags, OTF2_StringRef source_file,
+                                    uint32_t begin_line, uint32_t end_line)
+    {
+        auto& rewriter = *static_cast<DefinitionRewriter*>(user_data);
+        rewriter.write_new_strings();
+
+        if (auto it = rewriter.regions_.find(self); it != rewriter.regions_.end())
+        {
+            name = canonical_name = description = rewriter.strings_.at(it->second->function());
+            source_file = rewriter.strings_.at(it->second->file());
+            begin_line = it->second->line();
+            end_line = 0;
+        }
+        return rewriter.write(OTF2_GlobalDefWriter_WriteRegion(
+            rewriter.writer_, self, name, canonical_name, description, role, paradigm, flags,
+            source_file, begin_line, end_line));
+    }
+
+    static OTF2_CallbackCode source_code_location(void* user_data,
+                                                  OTF2_SourceCodeLocationRef self,
+                                                  OTF2_StringRef file, uint32_t line)
+    {
+        auto& rewriter = *static_cast<DefinitionRewriter*>(user_data);
+        rewriter.write_new_strings();
+
+        if (auto it = rewriter.scls_.find(self); it != rewriter.scls_.end())
+        {
+            file = rewriter.strings_.at(it->second->file());
+            line = it->second->line();
+        }
+        return rewriter.write(
+            OTF2_GlobalDefWriter_WriteSourceCodeLocation(rewriter.writer_, self, file, line));
+    }
+
+    static OTF2_CallbackCode calling_context(void* user_data, OTF2_CallingContextRef self,
+                                             OTF2_RegionRef region,
+                                             OTF2_SourceCodeLocationRef scl,
+                                             OTF2_CallingContextRef parent)
+    {
+        auto& rewriter = *static_cast<DefinitionRewriter*>(user_data);
+        if (auto it = rewriter.region_remap_.find(region); it != rewriter.region_remap_.end())
+        {
+            region = it->second;
+        }
+        return rewriter.write(
+            OTF2_GlobalDefWriter_WriteCallingContext(rewriter.writer_, self, region, scl, parent));
+    }
+
+    static OTF2_CallbackCode unknown(void* user_data)
+    {
+        auto& rewriter = *static_cast<DefinitionRewriter*>(user_data);
+        if (!rewriter.warned_unknown_)
+        {
+            Log::warn() << "dropping global definitions unknown to this OTF2 version";
+            rewriter.warned_unknown_ = true;
+        }
+        return OTF2_CALLBACK_SUCCESS;
+    }
+
+    // Copies every other definition unchanged
+    template <auto Write>
+    struct Forward;
+
+    template <typename... Args, OTF2_ErrorCode (*Write)(OTF2_GlobalDefWriter*, Args...)>
+    struct Forward<Write>
+    {
+        static OTF2_CallbackCode callback(void* user_data, Args... args)
+        {
+            auto& rewriter = *static_cast<DefinitionRewriter*>(user_data);
+            return rewriter.write(Write(rewriter.writer_, args...));
+        }
+    };
+
+private:
+    void add_string(const std::string& str)
+    {
+        if (strings_.emplace(str, next_string_).second)
+        {
+            new_strings_.push_back(&strings_.find(str)->first);
+            next_string_++;
+        }
+    }
+
+    void write_new_strings()
+    {
+        for (const auto* str : new_strings_)
+        {
+            write(OTF2_GlobalDefWriter_WriteString(writer_, strings_.at(*str), str->c_str()));
+        }
+        new_strings_.clear();
+    }
+
+    OTF2_CallbackCode write(OTF2_ErrorCode code)
+    {
+        if (code != OTF2_SUCCESS)
+        {
+            error_ = code;
+            return OTF2_CALLBACK_INTERRUPT;
+        }
+        return OTF2_CALLBACK_SUCCESS;
+    }
+
+    std::map<uint32_t, const LineInfo*> regions_;
+    std::unordered_map<uint32_t, const LineInfo*> scls_;
+    std::unordered_map<uint32_t, uint32_t> region_remap_;
+
+    OTF2_StringRef next_string_ = 0;
+    std::unordered_map<std::string, OTF2_StringRef> strings_;
+    std::vector<const std::string*> new_strings_;
+
+    OTF2_GlobalDefWriter* writer_ = nullptr;
+    OTF2_ErrorCode error_ = OTF2_SUCCESS;
+    bool warned_unknown_ = false;
+};
+
+#define LO2S_FORWARD_DEFINITION(callbacks, Name)                                                  \
+    check(OTF2_GlobalDefReaderCallbacks_Set##Name##Callback(                                       \
+              callbacks,                                                                           \
+              &DefinitionRewriter::Forward<&OTF2_GlobalDefWriter_Write##Name>::callback),          \
+          "could not register " #Name " callback")
+
+void count_strings(OTF2_GlobalDefReaderCallbacks* callbacks)
+{
+    check(OTF2_GlobalDefReaderCallbacks_SetStringCallback(callbacks,
+                                                          &DefinitionRewriter::count_string),
+          "could not register String callback");
+}
+
+void rewrite_all(OTF2_GlobalDefReaderCallbacks* callbacks)
+{
+    check(OTF2_GlobalDefReaderCallbacks_SetRegionCallback(callbacks, &DefinitionRewriter::region),
+          "could not register Region callback");
+    check(OTF2_GlobalDefReaderCallbacks_SetSourceCodeLocationCallback(
+              callbacks, &DefinitionRewriter::source_code_location),
+          "could not register SourceCodeLocation callback");
+    check(OTF2_GlobalDefReaderCallbacks_SetCallingContextCallback(
+              callbacks, &DefinitionRewriter::calling_context),
+          "could not register CallingContext callback");
+    check(OTF2_GlobalDefReaderCallbacks_SetUnknownCallback(callbacks, &DefinitionRewriter::unknown),
+          "could not register Unknown callback");
+
+    LO2S_FORWARD_DEFINITION(callbacks, ClockProperties);
+    LO2S_FORWARD_DEFINITION(callbacks, Paradigm);
+    LO2S_FORWARD_DEFINITION(callbacks, ParadigmProperty);
+    LO2S_FORWARD_DEFINITION(callbacks, IoParadigm);
+    LO2S_FORWARD_DEFINITION(callbacks, String);
+    LO2S_FORWARD_DEFINITION(callbacks, Attribute);
+    LO2S_FORWARD_DEFINITION(callbacks, SystemTreeNode);
+    LO2S_FORWARD_DEFINITION(callbacks, LocationGroup);
+    LO2S_FORWARD_DEFINITION(callbacks, Location);
+    LO2S_FORWARD_DEFINITION(callbacks, Callsite);
+    LO2S_FORWARD_DEFINITION(callbacks, Callpath);
+    LO2S_FORWARD_DEFINITION(callbacks, Group);
+    LO2S_FORWARD_DEFINITION(callbacks, MetricMember);
+    LO2S_FORWARD_DEFINITION(callbacks, MetricClass);
+    LO2S_FORWARD_DEFINITION(callbacks, MetricInstance);
+    LO2S_FORWARD_DEFINITION(callbacks, Comm);
+    LO2S_FORWARD_DEFINITION(callbacks, Parameter);
+    LO2S_FORWARD_DEFINITION(callbacks, RmaWin);
+    LO2S_FORWARD_DEFINITION(callbacks, MetricClassRecorder);
+    LO2S_FORWARD_DEFINITION(callbacks, SystemTreeNodeProperty);
+    LO2S_FORWARD_DEFINITION(callbacks, SystemTreeNodeDomain);
+    LO2S_FORWARD_DEFINITION(callbacks, LocationGroupProperty);
+    LO2S_FORWARD_DEFINITION(callbacks, LocationProperty);
+    LO2S_FORWARD_DEFINITION(callbacks, CartDimension);
+    LO2S_FORWARD_DEFINITION(callbacks, CartTopology);
+    LO2S_FORWARD_DEFINITION(callbacks, CartCoordinate);
+    LO2S_FORWARD_DEFINITION(callbacks, CallingContextProperty);
+    LO2S_FORWARD_DEFINITION(callbacks, InterruptGenerator);
+    LO2S_FORWARD_DEFINITION(callbacks, IoFileProperty);
+    LO2S_FORWARD_DEFINITION(callbacks, IoRegularFile);
+    LO2S_FORWARD_DEFINITION(callbacks, IoDirectory);
+    LO2S_FORWARD_DEFINITION(callbacks, IoHandle);
+    LO2S_FORWARD_DEFINITION(callbacks, IoPreCreatedHandleState);
+    LO2S_FORWARD_DEFINITION(callbacks, CallpathParameter);
+#if OTF2_VERSION_MAJOR >= 3
+    LO2S_FORWARD_DEFINITION(callbacks, InterComm);
+#endif
+}
+
+void read_definitions(const std::filesystem::path& anchor,
+                      void (*register_callbacks)(OTF2_GlobalDefReaderCallbacks*),
+                      DefinitionRewriter& rewriter)
+{
+    OTF2_Reader* reader = OTF2_Reader_Open(anchor.c_str());
+    if (reader == nullptr)
+    {
+        throw std::runtime_error("could not open " + anchor.string());
+    }
+
+    try
+    {
+        check(OTF2_Reader_SetSerialCollectiveCallbacks(reader), "could not set up reader");
+        OTF2_GlobalDefReader* def_reader = OTF2_Reader_GetGlobalDefReader(reader);
+        if (def_reader == nullptr)
+        {
+            throw std::runtime_error("could not read global definitions of " + anchor.string());
+        }
+
+        OTF2_GlobalDefReaderCallbacks* callbacks = OTF2_GlobalDefReaderCallbacks_New();
+        try
+        {
+            register_callbacks(callbacks);
+            check(OTF2_Reader_RegisterGlobalDefCallbacks(reader, def_reader, callbacks, &rewriter),
+                  "could not register callbacks");
+        }
+        catch (...)
+        {
+            OTF2_GlobalDefReaderCallbacks_Delete(callbacks);
+            throw;
+        }
+        OTF2_GlobalDefReaderCallbacks_Delete(callbacks);
+
+        uint64_t definitions_read = 0;
+        check(OTF2_Reader_ReadAllGlobalDefinitions(reader, def_reader, &definitions_read),
+              "could not read global definitions");
+        Log::debug() << "read " << definitions_read << " global definitions";
+    }
+    catch (...)
+    {
+        OTF2_Reader_Close(reader);
+        throw;
+    }
+    OTF2_Reader_Close(reader);
+}
+
+OTF2_FlushType pre_flush(void*, OTF2_FileType, OTF2_LocationRef, void*, bool)
+{
+    return OTF2_FLUSH;
+}
+
+OTF2_TimeStamp post_flush(void*, OTF2_FileType, OTF2_LocationRef)
+{
+    return 0;
+}
+} // namespace
+
+void rewrite_definitions(const std::filesystem::path& trace,
+                         const std::vector<ResolvedSymbol>& symbols)
+{
+    auto anchor = trace / "traces.otf2";
+
+    DefinitionRewriter rewriter(symbols);
+    read_definitions(anchor, &count_strings, rewriter);
+    rewriter.assign_strings();
+
+    // Write the new global definitions into a scratch archive, only its traces.def is kept
+    auto scratch = trace / ".lo2s-symbolize";
+    std::filesystem::remove_all(scratch);
+
+    OTF2_Archive* archive = OTF2_Archive_Open(
+        scratch.c_str(), "traces", OTF2_FILEMODE_WRITE, OTF2_CHUNK_SIZE_EVENTS_DEFAULT,
+        OTF2_CHUNK_SIZE_DEFINITIONS_DEFAULT, OTF2_SUBSTRATE_POSIX, OTF2_COMPRESSION_NONE);
+    if (archive == nullptr)
+    {
+        throw std::runtime_error("could not create " + scratch.string());
+    }
+
+    try
+    {
+        OTF2_FlushCallbacks flush_callbacks = { &pre_flush, &post_flush };
+        check(OTF2_Archive_SetFlushCallbacks(archive, &flush_callbacks, nullptr),
+              "could not set up archive");
+        check(OTF2_Archive_SetSerialCollectiveCallbacks(archive), "could not set up archive");
+
+        OTF2_GlobalDefWriter* writer = OTF2_Archive_GetGlobalDefWriter(archive);
+        if (writer == nullptr)
+        {
+            throw std::runtime_error("could not create global definition writer");
+        }
+        rewriter.set_writer(writer);
+
+        read_definitions(anchor, &rewrite_all, rewriter);
+        rewriter.finish();
+    }
+    catch (...)
+    {
+        OTF2_Archive_Close(archive);
+        std::filesystem::remove_all(scratch);
+        throw;
+    }
+    check(OTF2_Archive_Close(archive), "could not write global definitions");
+
+    // rename() is atomic, the trace either has the old or the new definitions
+    std::filesystem::rename(scratch / "traces.def", trace / "traces.def");
+    std::filesystem::remove_all(scratch);
+}
+} // namespace symbolize
+} // namespace lo2s
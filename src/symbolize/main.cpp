@@ -0,0 +1,350 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/config.hpp>
+#include <lo2s/elf_resolve.hpp>
+#include <lo2s/line_info.hpp>
+#include <lo2s/log.hpp>
+#include <lo2s/mmap.hpp>
+#include <lo2s/parallel.hpp>
+#include <lo2s/symbolize/definitions.hpp>
+
+#include <nitro/lang/optional.hpp>
+#include <nitro/options/parser.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+namespace lo2s
+{
+
+// lo2s-symbolize only needs the symbol related parts of the configuration
+static nitro::lang::optional<Config> instance;
+
+const Config& config()
+{
+    return *instance;
+}
+
+namespace symbolize
+{
+namespace
+{
+
+struct DeferredSymbol
+{
+    uint32_t region;
+    uint32_t scl;
+    uint64_t offset;
+    std::string build_id;
+    std::string binary;
+};
+
+const std::string SYMBOLS_FILE = "lo2s-symbols.txt";
+
+std::vector<DeferredSymbol> read_deferred_symbols(const std::filesystem::path& path)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        throw std::runtime_error("could not open " + path.string() +
+                                 ", was the trace recorded with --defer-symbols?");
+    }
+
+    std::vector<DeferredSymbol> symbols;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        DeferredSymbol symbol;
+        std::string offset;
+        fields >> symbol.region >> symbol.scl >> offset >> symbol.build_id;
+        fields.ignore(1);
+        // The path is the last field, so that it may contain spaces
+        std::getline(fields, symbol.binary);
+        if (fields.fail() || symbol.binary.empty())
+        {
+            throw std::runtime_error("malformed line in " + path.string() + ": " + line);
+        }
+        symbol.offset = std::stoull(offset, nullptr, 16);
+        symbols.push_back(std::move(symbol));
+    }
+    return symbols;
+}
+
+void write_deferred_symbols(const std::filesystem::path& path,
+                            const std::vector<const DeferredSymbol*>& symbols)
+{
+    auto tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp);
+        out << "# lo2s deferred symbols 1\n";
+        out << "# region\tscl\toffset\tbuild-id\tbinary\n";
+        for (const auto* symbol : symbols)
+        {
+            out << symbol->region << '\t' << symbol->scl << "\t0x" << std::hex << symbol->offset
+                << std::dec << '\t' << symbol->build_id << '\t' << symbol->binary << '\n';
+        }
+    }
+    std::filesystem::rename(tmp, path);
+}
+
+// Resolves the symbols of every binary on a pool of worker threads. Symbols of binaries that are
+// missing or have a different build-id than the recorded one are left unresolved.
+std::vector<std::optional<LineInfo>> resolve(const std::vector<DeferredSymbol>& symbols,
+                                             const std::filesystem::path& root)
+{
+    std::map<std::string, std::vector<std::size_t>> by_binary;
+    for (std::size_t i = 0; i < symbols.size(); i++)
+    {
+        by_binary[symbols[i].binary].push_back(i);
+    }
+    std::vector<const std::pair<const std::string, std::vector<std::size_t>>*> work;
+    for (const auto& binary : by_binary)
+    {
+        work.push_back(&binary);
+    }
+    std::sort(work.begin(), work.end(),
+              [](const auto* a, const auto* b) { return a->second.size() > b->second.size(); });
+
+    std::vector<std::optional<LineInfo>> resolved(symbols.size());
+    auto num_workers = parallel_for_each(work, [&](const auto* item) {
+        const auto& [name, indices] = *item;
+        auto path = root.empty() ? std::filesystem::path(name) :
+                                   root / std::filesystem::path(name).relative_path();
+
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(path, ec))
+        {
+            Log::warn() << "cannot resolve " << indices.size() << " symbols, " << path
+                        << " does not exist";
+            return;
+        }
+
+        const auto& build_id = symbols[indices.front()].build_id;
+        if (build_id != "-" && elfr::Lib::build_id(path) != build_id)
+        {
+            Log::warn() << "cannot resolve " << indices.size() << " symbols, " << path
+                        << " is not the binary that was traced";
+            return;
+        }
+
+        BfdRadareBinary binary(path);
+        for (auto index : indices)
+        {
+            try
+            {
+                resolved[index] = binary.lookup_line_info(symbols[index].offset);
+            }
+            catch (std::exception& e)
+            {
+                Log::debug() << "could not resolve " << Address(symbols[index].offset) << " in "
+                             << path << ": " << e.what();
+                resolved[index] = LineInfo::for_unknown_function_in_dso(name);
+            }
+        }
+    });
+    Log::debug() << "resolved symbols in " << work.size() << " binaries using " << num_workers
+                 << " threads";
+    return resolved;
+}
+
+struct Options
+{
+    std::filesystem::path trace;
+    std::filesystem::path root;
+};
+
+Options parse_program_options(int argc, const char** argv)
+{
+    std::stringstream description;
+    description << "Resolves the symbols of a trace that was recorded with lo2s --defer-symbols"
+                << std::endl
+                << std::endl;
+    description << "  " << argv[0] << " [options] TRACE\n";
+
+    nitro::options::parser parser("lo2s-symbolize", description.str());
+    parser.accept_positionals();
+    parser.positional_metavar("TRACE");
+
+    auto& general_options = parser.group("Options");
+
+    general_options.toggle("help", "Show this help message.").short_name("h");
+
+    general_options
+        .toggle("verbose",
+                "Verbose output (specify multiple times to get increasingly more verbose output).")
+        .short_name("v");
+
+    general_options
+        .option("root", "Look up the traced binaries below DIR instead of /, e.g. in a copy of "
+                        "the file system of the traced node.")
+        .metavar("DIR")
+        .optional();
+
+    general_options
+        .toggle("line-info", "Resolve source files and line numbers from debug information.")
+        .default_value(true)
+        .allow_reverse();
+
+    general_options
+        .option("symbol-cache", "Directory in which symbol indexes are kept across runs, keyed "
+                                "by build-id.")
+        .env("LO2S_SYMBOL_CACHE")
+        .metavar("DIR")
+        .optional();
+
+    general_options
+        .option("symbol-cache-size", "Maximum size of the --symbol-cache directory in MiB.")
+        .default_value("256")
+        .metavar("MIB");
+
+    nitro::options::arguments arguments;
+    try
+    {
+        arguments = parser.parse(argc, argv);
+    }
+    catch (const nitro::options::parsing_error& e)
+    {
+        std::cerr << e.what() << '\n';
+        parser.usage();
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (arguments.given("help"))
+    {
+        parser.usage();
+        std::exit(EXIT_SUCCESS);
+    }
+
+    if (arguments.positionals().size() != 1)
+    {
+        std::cerr << "Expected exactly one trace directory.\n";
+        parser.usage();
+        std::exit(EXIT_FAILURE);
+    }
+
+    using sl = nitro::log::severity_level;
+    switch (arguments.given("verbose"))
+    {
+    case 0:
+        lo2s::logging::set_min_severity_level(sl::info);
+        break;
+    case 1:
+        lo2s::logging::set_min_severity_level(sl::debug);
+        break;
+    default:
+        lo2s::logging::set_min_severity_level(sl::trace);
+        break;
+    }
+
+    Options options;
+    options.trace = arguments.positionals().front();
+    if (arguments.provided("root"))
+    {
+        options.root = arguments.get("root");
+    }
+
+    Config config;
+    config.line_info = arguments.given("line-info");
+    if (arguments.provided("symbol-cache"))
+    {
+        config.symbol_cache_dir = arguments.get("symbol-cache");
+    }
+    config.symbol_cache_size = arguments.as<std::size_t>("symbol-cache-size") * 1024 * 1024;
+
+    instance = std::move(config);
+    return options;
+}
+} // namespace
+} // namespace symbolize
+} // namespace lo2s
+
+int main(int argc, const char** argv)
+{
+    using namespace lo2s;
+
+    try
+    {
+        auto options = symbolize::parse_program_options(argc, argv);
+
+        const auto& trace = options.trace;
+        auto symbols_path = trace / symbolize::SYMBOLS_FILE;
+        auto symbols = symbolize::read_deferred_symbols(symbols_path);
+        auto line_infos = symbolize::resolve(symbols, options.root);
+
+        std::vector<symbolize::ResolvedSymbol> resolved;
+        std::vector<const symbolize::DeferredSymbol*> remaining;
+        for (std::size_t i = 0; i < symbols.size(); i++)
+        {
+            if (line_infos[i])
+            {
+                resolved.push_back({ symbols[i].region, symbols[i].scl, *line_infos[i] });
+            }
+            else
+            {
+                remaining.push_back(&symbols[i]);
+            }
+        }
+
+        if (!resolved.empty())
+        {
+            symbolize::rewrite_definitions(trace, resolved);
+        }
+
+        // Keep what could not be resolved, so it can be retried with another --root
+        if (remaining.empty())
+        {
+            std::filesystem::remove(symbols_path);
+        }
+        else
+        {
+            symbolize::write_deferred_symbols(symbols_path, remaining);
+        }
+
+        Log::info() << "resolved " << resolved.size() << " of " << symbols.size()
+                    << " symbols in " << trace;
+    }
+    catch (const std::exception& e)
+    {
+        Log::fatal() << "Aborting: " << e.what();
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
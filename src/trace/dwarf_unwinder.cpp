@@ -0,0 +1,284 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/trace/dwarf_unwinder.hpp>
+
+#include <lo2s/log.hpp>
+#include <lo2s/perf/sample/user_stack.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <cstring>
+
+extern "C"
+{
+#include <elfutils/libdwfl.h>
+#include <linux/perf_event.h>
+}
+
+namespace lo2s
+{
+namespace trace
+{
+
+namespace
+{
+// DWARF register numbers of x86_64 are rax, rdx, rcx, rbx, rsi, rdi, rbp, rsp, r8-r15, rip.
+// Positions of these registers in the order perf records them, see USER_REGS_MASK.
+constexpr std::size_t DWARF_REGS[] = { 0, 3, 2, 1, 4, 5, 6, 7, 9, 10, 11, 12, 13, 14, 15, 16, 8 };
+
+char* debuginfo_path = nullptr;
+
+const Dwfl_Callbacks* offline_callbacks()
+{
+    static Dwfl_Callbacks callbacks = []() {
+        Dwfl_Callbacks c{};
+        c.find_debuginfo = dwfl_standard_find_debuginfo;
+        c.section_address = dwfl_offline_section_address;
+        c.debuginfo_path = &debuginfo_path;
+        return c;
+    }();
+    return &callbacks;
+}
+} // namespace
+
+/*
+ * The libdw session of one process. libdw pulls the initial registers and the stack memory through
+ * callbacks, which read from the stack that is currently being unwound.
+ */
+class DwarfUnwinder::ProcessState
+{
+public:
+    ProcessState(Process process, const MemoryMap& maps)
+    : process_(process), dwfl_(dwfl_begin(offline_callbacks()))
+    {
+        if (dwfl_ == nullptr)
+        {
+            return;
+        }
+
+        // Report every binary once, at the load bias of its first mapping
+        std::set<std::string> reported;
+        dwfl_report_begin(dwfl_);
+        maps.for_each_mapping([this, &reported](Address start, Address, Address pgoff,
+                                                const Binary& binary) {
+            const auto& name = binary.name();
+            if (name.empty() || name[0] != '/' || !reported.emplace(name).second)
+            {
+                return;
+            }
+            if (dwfl_report_elf(dwfl_, name.c_str(), name.c_str(), -1,
+                                start.value() - pgoff.value(), false) == nullptr)
+            {
+                Log::debug() << "libdw could not load " << name << ": " << dwfl_errmsg(-1);
+            }
+        });
+        dwfl_report_end(dwfl_, nullptr, nullptr);
+
+        static const Dwfl_Thread_Callbacks thread_callbacks = { next_thread, nullptr, memory_read,
+                                                               set_initial_registers, nullptr,
+                                                               nullptr };
+        attached_ = dwfl_attach_state(dwfl_, nullptr, process_.as_pid_t(), &thread_callbacks,
+                                      this);
+        if (!attached_)
+        {
+            Log::debug() << "libdw can not unwind stacks of " << process_.as_pid_t() << ": "
+                         << dwfl_errmsg(-1);
+        }
+    }
+
+    ~ProcessState()
+    {
+        if (dwfl_ != nullptr)
+        {
+            dwfl_end(dwfl_);
+        }
+    }
+
+    ProcessState(const ProcessState&) = delete;
+    ProcessState& operator=(const ProcessState&) = delete;
+
+    std::vector<Address> unwind(const SpilledStack& stack)
+    {
+        std::vector<Address> frames;
+        if (stack.num_regs != perf::sample::NUM_USER_REGS)
+        {
+            return frames;
+        }
+
+        if (attached_)
+        {
+            current_ = &stack;
+            frames_ = &frames;
+            dwfl_getthread_frames(dwfl_, process_.as_pid_t(), frame_callback, this);
+            current_ = nullptr;
+            frames_ = nullptr;
+        }
+
+        // At least the sampled instruction is always known
+        if (frames.empty())
+        {
+            frames.emplace_back(stack.regs[perf::sample::USER_REG_IP]);
+        }
+        return frames;
+    }
+
+private:
+    // Only the sampled thread is ever unwound
+    static pid_t next_thread(Dwfl* dwfl, void* arg, void** thread_argp)
+    {
+        if (*thread_argp != nullptr)
+        {
+            return 0;
+        }
+        *thread_argp = arg;
+        return dwfl_pid(dwfl);
+    }
+
+    static bool memory_read(Dwfl*, Dwarf_Addr addr, Dwarf_Word* result, void* arg)
+    {
+        const auto* stack = static_cast<ProcessState*>(arg)->current_;
+        uint64_t sp = stack->regs[perf::sample::USER_REG_SP];
+        if (addr < sp || addr + sizeof(Dwarf_Word) > sp + stack->size)
+        {
+            return false;
+        }
+        std::memcpy(result, stack->data + (addr - sp), sizeof(Dwarf_Word));
+        return true;
+    }
+
+    static bool set_initial_registers(Dwfl_Thread* thread, void* arg)
+    {
+        const auto* stack = static_cast<ProcessState*>(arg)->current_;
+        Dwarf_Word regs[std::size(DWARF_REGS)];
+        for (std::size_t i = 0; i < std::size(DWARF_REGS); i++)
+        {
+            regs[i] = stack->regs[DWARF_REGS[i]];
+        }
+        return dwfl_thread_state_registers(thread, 0, std::size(DWARF_REGS), regs);
+    }
+
+    static int frame_callback(Dwfl_Frame* frame, void* arg)
+    {
+        auto* self = static_cast<ProcessState*>(arg);
+        Dwarf_Addr pc;
+        bool is_activation;
+        if (!dwfl_frame_pc(frame, &pc, &is_activation))
+        {
+            return DWARF_CB_ABORT;
+        }
+
+        self->frames_->emplace_back(pc);
+        return self->frames_->size() < MAX_FRAMES ? DWARF_CB_OK : DWARF_CB_ABORT;
+    }
+
+    Process process_;
+    Dwfl* dwfl_;
+    bool attached_ = false;
+
+    const SpilledStack* current_ = nullptr;
+    std::vector<Address>* frames_ = nullptr;
+};
+
+DwarfUnwinder::DwarfUnwinder(const ProcessMaps& maps) : maps_(maps)
+{
+}
+
+DwarfUnwinder::~DwarfUnwinder() = default;
+
+DwarfUnwinder::ProcessState& DwarfUnwinder::state(Process process)
+{
+    auto it = states_.find(process);
+    if (it == states_.end())
+    {
+        std::shared_ptr<const MemoryMap> maps = std::make_shared<MemoryMap>();
+        if (auto snapshot = maps_.find(process); snapshot != maps_.end())
+        {
+            maps = snapshot->second;
+        }
+        it = states_.emplace(process, std::make_unique<ProcessState>(process, *maps)).first;
+    }
+    return *it->second;
+}
+
+void DwarfUnwinder::unwind(const std::vector<char>& chunk, UnwoundStacks& unwound)
+{
+    std::map<Process, std::vector<SpilledStack>> stacks;
+    StackSpill::for_each(chunk, [&stacks](const SpilledStack& stack) {
+        if (stack.num_regs != 0)
+        {
+            stacks[stack.process].push_back(stack);
+        }
+    });
+
+    // Setting up the libdw sessions touches the shared maps, so do it up front
+    std::vector<std::pair<ProcessState*, const std::vector<SpilledStack>*>> work;
+    for (const auto& [process, process_stacks] : stacks)
+    {
+        work.emplace_back(&state(process), &process_stacks);
+    }
+    std::sort(work.begin(), work.end(),
+              [](const auto& a, const auto& b) { return a.second->size() > b.second->size(); });
+
+    std::mutex unwound_mutex;
+    std::atomic<std::size_t> next = 0;
+    auto worker = [&]() {
+        std::vector<std::pair<uint64_t, std::vector<Address>>> results;
+        for (auto i = next++; i < work.size(); i = next++)
+        {
+            for (const auto& stack : *work[i].second)
+            {
+                results.emplace_back(stack.id, work[i].first->unwind(stack));
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(unwound_mutex);
+        for (auto& [id, frames] : results)
+        {
+            unwound.emplace(id, std::move(frames));
+        }
+    };
+
+    std::size_t num_workers =
+        std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), work.size());
+    Log::debug() << "unwinding stacks of " << work.size() << " processes using " << num_workers
+                 << " threads";
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < num_workers; i++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+}
+} // namespace trace
+} // namespace lo2s
@@ -0,0 +1,144 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/trace/kernel_stack_table.hpp>
+
+#include <lo2s/log.hpp>
+
+#include <fstream>
+#include <sstream>
+
+namespace lo2s
+{
+namespace trace
+{
+
+KernelStackTable::StackId KernelStackTable::intern(const uint64_t* frames, std::size_t nr)
+{
+    Frames key(frames, frames + nr);
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        if (auto it = ids_.find(key); it != ids_.end())
+        {
+            return it->second;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    // Another writer might have inserted the same stack in the meantime
+    auto [it, inserted] = ids_.try_emplace(std::move(key), stacks_.size());
+    if (inserted)
+    {
+        stacks_.push_back(&it->first);
+    }
+    return it->second;
+}
+
+const KernelStackTable::Frames& KernelStackTable::frames(StackId id) const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return *stacks_.at(id);
+}
+
+const std::vector<LineInfo>& KernelStackTable::line_infos(StackId id)
+{
+    std::lock_guard<std::mutex> guard(resolve_mutex_);
+    auto it = line_infos_.find(id);
+    if (it == line_infos_.end())
+    {
+        std::vector<LineInfo> infos;
+        for (auto ip : frames(id))
+        {
+            auto resolved = resolved_ips_.find(ip);
+            if (resolved == resolved_ips_.end())
+            {
+                resolved = resolved_ips_.emplace(ip, resolve(ip)).first;
+            }
+            infos.push_back(resolved->second);
+        }
+        it = line_infos_.emplace(id, std::move(infos)).first;
+    }
+    return it->second;
+}
+
+LineInfo KernelStackTable::resolve(uint64_t ip)
+{
+    if (!kallsyms_read_)
+    {
+        read_kallsyms();
+        kallsyms_read_ = true;
+    }
+
+    auto it = kallsyms_.upper_bound(ip);
+    if (it == kallsyms_.begin())
+    {
+        return LineInfo::for_unknown_function_in_dso("[kernel.kallsyms]");
+    }
+    --it;
+    const auto& [symbol, module] = it->second;
+    return LineInfo::for_function(nullptr, symbol.c_str(), 0, module);
+}
+
+void KernelStackTable::read_kallsyms()
+{
+    std::ifstream kallsyms("/proc/kallsyms");
+    if (!kallsyms)
+    {
+        Log::warn() << "Could not read /proc/kallsyms, kernel frames will not be resolved.";
+        return;
+    }
+
+    std::string line;
+    while (std::getline(kallsyms, line))
+    {
+        std::istringstream fields(line);
+        std::string address, type, symbol, module;
+        fields >> address >> type >> symbol >> module;
+
+        // Only text symbols can show up in callchains
+        if (type != "t" && type != "T")
+        {
+            continue;
+        }
+
+        uint64_t start = Address(address).value();
+        // Without sufficient privileges, all addresses read as zero
+        if (start == 0)
+        {
+            continue;
+        }
+
+        if (module.empty())
+        {
+            module = "[kernel.kallsyms]";
+        }
+        kallsyms_.emplace(start, std::make_pair(std::move(symbol), std::move(module)));
+    }
+
+    if (kallsyms_.empty())
+    {
+        Log::warn() << "No kernel symbols available in /proc/kallsyms, kernel frames will not be "
+                       "resolved. Check kernel.kptr_restrict.";
+    }
+}
+} // namespace trace
+} // namespace lo2s
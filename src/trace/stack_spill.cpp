@@ -0,0 +1,157 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/trace/stack_spill.hpp>
+
+#include <lo2s/error.hpp>
+#include <lo2s/log.hpp>
+
+#include <algorithm>
+
+#include <cstring>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace lo2s
+{
+namespace trace
+{
+
+StackSpill::StackSpill(const std::filesystem::path& path)
+{
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd_ == -1)
+    {
+        Log::error() << "Failed to create the stack spill file " << path;
+        throw_errno();
+    }
+    ::unlink(path.c_str());
+
+    buffer_.reserve(BUFFER_SIZE);
+}
+
+StackSpill::~StackSpill()
+{
+    ::close(fd_);
+}
+
+uint64_t StackSpill::append(Process process, const uint64_t* regs, std::size_t num_regs,
+                            const char* data, uint64_t size)
+{
+    auto record_bytes = record_size(num_regs, size);
+    if (buffer_.size() + record_bytes > BUFFER_SIZE)
+    {
+        write_buffer();
+    }
+
+    RecordHeader header{ next_id_, process.as_pid_t(), num_regs, size };
+
+    auto pos = buffer_.size();
+    // Stays within the reserved capacity for all records that fit into the buffer at all
+    buffer_.resize(pos + record_bytes);
+    std::memcpy(buffer_.data() + pos, &header, sizeof(header));
+    pos += sizeof(header);
+    std::memcpy(buffer_.data() + pos, regs, num_regs * sizeof(uint64_t));
+    pos += num_regs * sizeof(uint64_t);
+    std::memcpy(buffer_.data() + pos, data, size);
+
+    return next_id_++;
+}
+
+uint64_t StackSpill::flush()
+{
+    write_buffer();
+    return written_;
+}
+
+void StackSpill::write_buffer()
+{
+    std::size_t done = 0;
+    while (done < buffer_.size())
+    {
+        auto ret = ::write(fd_, buffer_.data() + done, buffer_.size() - done);
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            Log::error() << "Failed to write to the stack spill file";
+            throw_errno();
+        }
+        done += ret;
+    }
+    written_ += buffer_.size();
+    buffer_.clear();
+}
+
+std::vector<char> StackSpill::read(uint64_t& pos, uint64_t end, std::size_t max_bytes) const
+{
+    std::vector<char> chunk(
+        std::min<uint64_t>(end - pos, std::max(max_bytes, sizeof(RecordHeader))));
+
+    std::size_t done = 0;
+    while (done < chunk.size())
+    {
+        auto ret = ::pread(fd_, chunk.data() + done, chunk.size() - done, pos + done);
+        if (ret == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            Log::error() << "Failed to read from the stack spill file";
+            throw_errno();
+        }
+        done += ret;
+    }
+
+    // Cut off the last record if it has only been read partially
+    std::size_t complete = 0;
+    while (complete + sizeof(RecordHeader) <= chunk.size())
+    {
+        const auto* header = reinterpret_cast<const RecordHeader*>(chunk.data() + complete);
+        auto size = record_size(header->num_regs, header->size);
+        if (complete + size > chunk.size())
+        {
+            break;
+        }
+        complete += size;
+    }
+
+    // A single record is larger than max_bytes
+    if (complete == 0 && chunk.size() >= sizeof(RecordHeader))
+    {
+        const auto* header = reinterpret_cast<const RecordHeader*>(chunk.data());
+        return read(pos, end, record_size(header->num_regs, header->size));
+    }
+
+    chunk.resize(complete);
+    pos += complete;
+    return chunk;
+}
+} // namespace trace
+} // namespace lo2s
@@ -0,0 +1,179 @@
+/*
+ * This file is part of the lo2s software.
+ * Linux OTF2 sampling
+ *
+ * Copyright (c) 2024,
+ *    Technische Universitaet Dresden, Germany
+ *
+ * lo2s is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lo2s is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with lo2s.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <lo2s/trace/symbol_resolver.hpp>
+
+#include <lo2s/config.hpp>
+#include <lo2s/log.hpp>
+#include <lo2s/parallel.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+
+namespace lo2s
+{
+namespace trace
+{
+
+SymbolResolver::SymbolResolver(const ProcessMaps& maps) : maps_(maps)
+{
+}
+
+void SymbolResolver::add(Process process, Address ip)
+{
+    auto maps = maps_.find(process);
+    if (maps == maps_.end())
+    {
+        return;
+    }
+
+    try
+    {
+        auto [binary, offset] = maps->second->lookup_binary(ip);
+        binaries_[binary].try_emplace(offset.value());
+    }
+    catch (std::out_of_range&)
+    {
+        // Not mapped, line_info() will fall back to an unknown function
+    }
+}
+
+void SymbolResolver::resolve()
+{
+    std::vector<std::pair<Binary* const, BinaryIps>*> work;
+    for (auto& binary : binaries_)
+    {
+        // Binaries without a file, like [vdso], resolve to their name without any lookup anyway
+        if (config().defer_symbols && dynamic_cast<BfdRadareBinary*>(binary.first) != nullptr)
+        {
+            for (auto& [offset, resolved] : binary.second)
+            {
+                resolved.line_info = LineInfo::for_offset_in_dso(binary.first->name(), offset);
+                resolved.deferred = true;
+            }
+            continue;
+        }
+        work.push_back(&binary);
+    }
+
+    // Start with the binaries that have the most ips, so that no single worker is left with a
+    // huge binary at the end
+    std::sort(work.begin(), work.end(),
+              [](const auto* a, const auto* b) { return a->second.size() > b->second.size(); });
+
+    auto num_workers = parallel_for_each(work, [](auto* item) {
+        auto& binary = *item->first;
+        for (auto& [offset, resolved] : item->second)
+        {
+            try
+            {
+                resolved.line_info = binary.lookup_line_info(offset);
+            }
+            catch (std::exception& e)
+            {
+                Log::debug() << "could not resolve " << Address(offset) << " in " << binary.name()
+                             << ": " << e.what();
+                resolved.line_info = LineInfo::for_unknown_function_in_dso(binary.name());
+            }
+
+            if (config().disassemble)
+            {
+                try
+                {
+                    resolved.instruction = binary.lookup_instruction(offset);
+                }
+                catch (std::exception& e)
+                {
+                    LO2S_HOT_LOG(trace) << "could not read instruction from " << Address(offset)
+                                        << " in " << binary.name() << ": " << e.what();
+                }
+            }
+        }
+    });
+    Log::debug() << "resolved ips in " << work.size() << " binaries using " << num_workers
+                 << " threads";
+}
+
+const SymbolResolver::Resolved* SymbolResolver::find(Process process, Address ip) const
+{
+    auto maps = maps_.find(process);
+    if (maps == maps_.end())
+    {
+        return nullptr;
+    }
+
+    try
+    {
+        auto [binary, offset] = maps->second->lookup_binary(ip);
+        return &binaries_.at(binary).at(offset.value());
+    }
+    catch (std::out_of_range&)
+    {
+        return nullptr;
+    }
+}
+
+LineInfo SymbolResolver::line_info(Process process, Address ip) const
+{
+    if (const auto* resolved = find(process, ip))
+    {
+        return resolved->line_info;
+    }
+    return LineInfo::for_unknown_function();
+}
+
+const std::string* SymbolResolver::instruction(Process process, Address ip) const
+{
+    const auto* resolved = find(process, ip);
+    if (resolved == nullptr || !resolved->instruction)
+    {
+        return nullptr;
+    }
+    return &*resolved->instruction;
+}
+
+std::optional<std::pair<const Binary*, Address>> SymbolResolver::deferred(Process process,
+                                                                          Address ip) const
+{
+    auto maps = maps_.find(process);
+    if (maps == maps_.end())
+    {
+        return std::nullopt;
+    }
+
+    try
+    {
+        auto [binary, offset] = maps->second->lookup_binary(ip);
+        if (binaries_.at(binary).at(offset.value()).deferred)
+        {
+            return std::make_pair(binary, offset);
+        }
+    }
+    catch (std::out_of_range&)
+    {
+    }
+    return std::nullopt;
+}
+} // namespace trace
+} // namespace lo2s
@@ -24,6 +24,7 @@
 #include <lo2s/address.hpp>
 #include <lo2s/bfd_resolve.hpp>
 #include <lo2s/config.hpp>
+#include <lo2s/elf_resolve.hpp>
 #include <lo2s/line_info.hpp>
 #include <lo2s/mmap.hpp>
 #include <lo2s/monitor/main_monitor.hpp>
@@ -44,12 +45,19 @@
 #include <fmt/core.h>
 
 #include <filesystem>
+#include <fstream>
 #include <map>
 #include <mutex>
 #include <regex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <tuple>
 
+extern "C"
+{
+#include <unistd.h>
+}
+
 namespace lo2s
 {
 namespace trace
@@ -280,6 +288,11 @@ Trace::~Trace()
 
     archive_ << otf2::definition::clock_properties(starting_time_, stopping_time_);
 
+    if (config().defer_symbols)
+    {
+        write_deferred_symbols();
+    }
+
     std::filesystem::path symlink_path = nitro::env::get("LO2S_OUTPUT_LINK");
 
     if (symlink_path.empty())
@@ -300,6 +313,36 @@ Trace::~Trace()
     std::filesystem::create_symlink(trace_name_, symlink_path);
 }
 
+void Trace::write_deferred_symbols()
+{
+    auto path = std::filesystem::path(trace_name_) / "lo2s-symbols.txt";
+    std::ofstream out(path);
+    if (!out)
+    {
+        Log::error() << "could not write " << path << ", the trace cannot be symbolized";
+        return;
+    }
+
+    out << "# lo2s deferred symbols 1\n";
+    out << "# region\tscl\toffset\tbuild-id\tbinary\n";
+
+    std::map<const Binary*, std::string> build_ids;
+    for (const auto& [region, symbol] : deferred_symbols_)
+    {
+        auto build_id = build_ids.find(symbol.binary);
+        if (build_id == build_ids.end())
+        {
+            auto id = elfr::Lib::build_id(symbol.binary->name());
+            build_id = build_ids.emplace(symbol.binary, id.empty() ? "-" : id).first;
+        }
+        out << region << '\t' << symbol.scl << "\t0x" << std::hex << symbol.offset.value()
+            << std::dec << '\t' << build_id->second << '\t' << symbol.binary->name() << '\n';
+    }
+
+    Log::info() << "deferred " << deferred_symbols_.size() << " symbols in "
+                << build_ids.size() << " binaries to lo2s-symbolize";
+}
+
 const otf2::definition::system_tree_node& Trace::intern_process_node(Process process)
 {
     if (registry_.has<otf2::definition::system_tree_node>(ByProcess(process)))
@@ -595,68 +638,169 @@ otf2::definition::metric_class& Trace::metric_class()
                                                             otf2::common::recorder_kind::abstract);
 }
 
-void Trace::merge_ips(const IpRefMap& new_children, IpCctxMap& children,
-                      std::vector<uint32_t>& mapping_table,
-                      otf2::definition::calling_context& parent,
-                      const std::map<Process, ProcessInfo>& infos, Process process)
+void Trace::collect_ips(const CallingContextTrie& trie, CallingContextTrie::NodeId local_parent,
+                        const IpCctxMap* children, SymbolResolver& resolver, Process process,
+                        const UnwoundStacks& unwound)
 {
-    for (const auto& elem : new_children)
-    {
-        auto& ip = elem.first;
-        auto& local_ref = elem.second.ref;
-        auto& local_children = elem.second.children;
-        LineInfo line_info = LineInfo::for_unknown_function();
+    trie.for_each_child(local_parent, [&](Address ip, CallingContextTrie::NodeId local_ref) {
+        // Kernel stacks are resolved once in the kernel stack table
+        if (KernelStackTable::is_tag(ip))
+        {
+            return;
+        }
 
-        auto info_it = infos.find(process);
-        if (info_it != infos.end())
+        // Placeholder for a spilled user stack, which is only known after unwinding
+        if (StackSpill::is_tag(ip))
         {
-            MemoryMap maps = info_it->second.maps();
-            line_info = maps.lookup_line_info(ip);
+            if (auto frames = unwound.find(StackSpill::id(ip)); frames != unwound.end())
+            {
+                for (auto frame : frames->second)
+                {
+                    resolver.add(process, frame);
+                }
+            }
+            collect_ips(trie, local_ref, nullptr, resolver, process, unwound);
+            return;
         }
 
-        Log::trace() << "resolved " << ip << ": " << line_info;
-        auto cctx_it = children.find(ip);
-        if (cctx_it == children.end())
+        const IpCctxMap* grandchildren = nullptr;
+        if (children != nullptr)
         {
-            auto& new_cctx = registry_.create<otf2::definition::calling_context>(
-                intern_region(line_info), intern_scl(line_info), parent);
-            auto r = children.emplace(ip, new_cctx);
-            cctx_it = r.first;
+            if (auto cctx_it = children->find(ip); cctx_it != children->end())
+            {
+                grandchildren = &cctx_it->second.children;
+            }
+        }
+
+        // Only calling contexts that are not yet part of the global tree need to be resolved
+        if (grandchildren == nullptr)
+        {
+            resolver.add(process, ip);
+        }
+
+        collect_ips(trie, local_ref, grandchildren, resolver, process, unwound);
+    });
+}
 
-            if (config().disassemble && infos.count(process) == 1)
+IpCctxEntry& Trace::find_or_create_cctx(IpCctxMap& children, Address ip,
+                                        otf2::definition::calling_context& parent,
+                                        const SymbolResolver& resolver, Process process)
+{
+    auto cctx_it = children.find(ip);
+    if (cctx_it == children.end())
+    {
+        LineInfo line_info = resolver.line_info(process, ip);
+        LO2S_HOT_LOG(trace) << "resolved " << ip << ": " << line_info;
+
+        const auto& region = intern_region(line_info);
+        const auto& scl = intern_scl(line_info);
+        auto& new_cctx = registry_.create<otf2::definition::calling_context>(region, scl, parent);
+        auto r = children.emplace(ip, new_cctx);
+        cctx_it = r.first;
+
+        if (config().defer_symbols)
+        {
+            if (auto deferred = resolver.deferred(process, ip))
             {
-                try
-                {
-                    auto instruction = infos.at(process).maps().lookup_instruction(ip);
-                    Log::trace() << "mapped " << ip << " to " << instruction;
+                deferred_symbols_.try_emplace(region.ref(),
+                                              DeferredSymbol{ scl.ref(), deferred->first,
+                                                              deferred->second });
+            }
+        }
 
-                    registry_.create<otf2::definition::calling_context_property>(
-                        new_cctx, intern("instruction"),
-                        otf2::attribute_value(intern(instruction)));
-                }
-                catch (std::exception& ex)
+        if (config().disassemble)
+        {
+            if (const auto* instruction = resolver.instruction(process, ip))
+            {
+                LO2S_HOT_LOG(trace) << "mapped " << ip << " to " << *instruction;
+
+                registry_.create<otf2::definition::calling_context_property>(
+                    new_cctx, intern("instruction"), otf2::attribute_value(intern(*instruction)));
+            }
+        }
+    }
+    return cctx_it->second;
+}
+
+void Trace::merge_ips(const CallingContextTrie& trie, CallingContextTrie::NodeId local_parent,
+                      IpCctxMap& children, std::vector<uint32_t>& mapping_table,
+                      otf2::definition::calling_context& parent, const SymbolResolver& resolver,
+                      Process process, const UnwoundStacks& unwound)
+{
+    trie.for_each_child(local_parent, [&](Address ip, CallingContextTrie::NodeId local_ref) {
+        // Kernel stacks are always leaves of the local tree
+        if (KernelStackTable::is_tag(ip))
+        {
+            mapping_table.at(local_ref) =
+                merge_kernel_stack(children, parent, KernelStackTable::id(ip)).ref();
+            return;
+        }
+
+        // Expand the unwound user stack, its frames are innermost first. If it could not be
+        // unwound, the sample is attributed to the parent.
+        if (StackSpill::is_tag(ip))
+        {
+            IpCctxMap* current_children = &children;
+            otf2::definition::calling_context* current = &parent;
+            if (auto frames = unwound.find(StackSpill::id(ip)); frames != unwound.end())
+            {
+                for (auto frame = frames->second.rbegin(); frame != frames->second.rend(); ++frame)
                 {
-                    Log::trace() << "could not read instruction from " << ip << ": " << ex.what();
+                    auto& entry =
+                        find_or_create_cctx(*current_children, *frame, *current, resolver, process);
+                    current = &entry.cctx;
+                    current_children = &entry.children;
                 }
             }
+            mapping_table.at(local_ref) = current->ref();
+
+            merge_ips(trie, local_ref, *current_children, mapping_table, *current, resolver,
+                      process, unwound);
+            return;
         }
-        auto& cctx = cctx_it->second.cctx;
-        mapping_table.at(local_ref) = cctx.ref();
 
-        merge_ips(local_children, cctx_it->second.children, mapping_table, cctx, infos, process);
+        auto& entry = find_or_create_cctx(children, ip, parent, resolver, process);
+        mapping_table.at(local_ref) = entry.cctx.ref();
+
+        merge_ips(trie, local_ref, entry.children, mapping_table, entry.cctx, resolver, process,
+                  unwound);
+    });
+}
+
+otf2::definition::calling_context&
+Trace::merge_kernel_stack(IpCctxMap& children, otf2::definition::calling_context& parent,
+                          KernelStackTable::StackId id)
+{
+    const auto& frames = kernel_stacks_.frames(id);
+    const auto& line_infos = kernel_stacks_.line_infos(id);
+
+    IpCctxMap* current_children = &children;
+    otf2::definition::calling_context* current = &parent;
+    // frames are innermost first, the tree is built from the outermost frame
+    for (std::size_t i = frames.size(); i-- > 0;)
+    {
+        auto cctx_it = current_children->find(frames[i]);
+        if (cctx_it == current_children->end())
+        {
+            auto& new_cctx = registry_.create<otf2::definition::calling_context>(
+                intern_region(line_infos[i]), intern_scl(line_infos[i]), *current);
+            cctx_it = current_children->emplace(frames[i], new_cctx).first;
+        }
+        current = &cctx_it->second.cctx;
+        current_children = &cctx_it->second.children;
     }
+    return *current;
 }
 
-otf2::definition::mapping_table
-Trace::merge_calling_contexts(const std::map<Thread, ThreadCctxRefs>& new_ips, size_t num_ip_refs,
-                              const std::map<Process, ProcessInfo>& infos)
+void Trace::merge_calling_contexts(const std::map<Thread, ThreadCctxRefs>& new_ips,
+                                   const CallingContextTrie& trie, std::vector<uint32_t>& mappings,
+                                   const SymbolResolver& resolver, const UnwoundStacks& unwound)
 {
     std::lock_guard<std::recursive_mutex> guard(mutex_);
-#ifndef NDEBUG
-    std::vector<uint32_t> mappings(num_ip_refs, -1u);
-#else
-    std::vector<uint32_t> mappings(num_ip_refs);
-#endif
+    if (mappings.size() < trie.next_id())
+    {
+        mappings.resize(trie.next_id(), -1u);
+    }
 
     // Merge local thread tree into global thread tree
     for (auto& local_thread_cctx : new_ips)
@@ -666,7 +810,7 @@ Trace::merge_calling_contexts(const std::map<Thread, ThreadCctxRefs>& new_ips, s
         auto process = local_thread_cctx.second.process;
 
         groups_.add_thread(thread, process);
-        auto local_ref = local_thread_cctx.second.entry.ref;
+        auto local_ref = local_thread_cctx.second.root;
 
         auto global_thread_cctx = calling_context_tree_.find(thread);
 
@@ -703,19 +847,101 @@ Trace::merge_calling_contexts(const std::map<Thread, ThreadCctxRefs>& new_ips, s
         assert(global_thread_cctx != calling_context_tree_.end());
         mappings.at(local_ref) = global_thread_cctx->second.cctx.ref();
 
-        merge_ips(local_thread_cctx.second.entry.children, global_thread_cctx->second.children,
-                  mappings, global_thread_cctx->second.cctx, infos, process);
+        merge_ips(trie, local_ref, global_thread_cctx->second.children, mappings,
+                  global_thread_cctx->second.cctx, resolver, process, unwound);
     }
+}
 
-#ifndef NDEBUG
-    for (auto id : mappings)
+void Trace::unwind_stacks([[maybe_unused]] ThreadCctxRefMap& cctx,
+                          [[maybe_unused]] uint64_t spill_end,
+                          [[maybe_unused]] const ProcessMaps& process_maps,
+                          [[maybe_unused]] UnwoundStacks& unwound)
+{
+#ifdef HAVE_LIBDW
+    // Stack dumps are large, so only a chunk of them is kept in memory at a time
+    constexpr std::size_t CHUNK_SIZE = 64 * 1024 * 1024;
+
+    DwarfUnwinder unwinder(process_maps);
+    while (cctx.spill_read < spill_end)
     {
-        assert(id != -1u);
+        auto chunk = cctx.spill->read(cctx.spill_read, spill_end, CHUNK_SIZE);
+        if (chunk.empty())
+        {
+            break;
+        }
+        unwinder.unwind(chunk, unwound);
     }
 #endif
+}
 
-    return otf2::definition::mapping_table(
-        otf2::definition::mapping_table::mapping_type_type::calling_context, mappings);
+void Trace::merge_pending_calling_contexts(const ProcessMaps& process_maps)
+{
+    struct Work
+    {
+        ThreadCctxRefMap* cctx;
+        std::vector<CctxDelta> deltas;
+        UnwoundStacks unwound;
+    };
+
+    // New sample writers may still be created while recording. Elements of a deque stay in place
+    // on emplace_back(), so it is enough to hold the lock while taking the snapshot.
+    std::vector<Work> work;
+    {
+        std::lock_guard<std::mutex> guard(cctx_refs_mutex_);
+        for (auto& cctx : cctx_refs_)
+        {
+            std::lock_guard<std::mutex> pending_guard(cctx.pending_mutex);
+            if (!cctx.pending.empty())
+            {
+                work.push_back(Work{ &cctx, std::move(cctx.pending), {} });
+                cctx.pending.clear();
+            }
+        }
+    }
+
+    // User stacks recorded with --call-graph-dwarf have to be unwound before their frames can be
+    // resolved
+    for (auto& [cctx, deltas, unwound] : work)
+    {
+        if (cctx->spill)
+        {
+            unwind_stacks(*cctx, deltas.back().spill_end, process_maps, unwound);
+        }
+    }
+
+    // First, resolve all new ips in parallel. Reading the global tree is safe while holding the
+    // lock, as it is only modified by merges.
+    SymbolResolver resolver(process_maps);
+    {
+        std::lock_guard<std::recursive_mutex> guard(mutex_);
+        for (const auto& [cctx, deltas, unwound] : work)
+        {
+            for (const auto& delta : deltas)
+            {
+                for (const auto& [thread, refs] : delta.map)
+                {
+                    auto global_thread_cctx = calling_context_tree_.find(thread);
+                    collect_ips(delta.trie, refs.root,
+                                global_thread_cctx != calling_context_tree_.end() ?
+                                    &global_thread_cctx->second.children :
+                                    nullptr,
+                                resolver, refs.process, unwound);
+                }
+            }
+        }
+    }
+    resolver.resolve();
+
+    // Second, create the definitions serially. Every delta is released right after it has been
+    // merged.
+    for (auto& [cctx, deltas, unwound] : work)
+    {
+        for (auto& delta : deltas)
+        {
+            merge_calling_contexts(delta.map, delta.trie, cctx->mappings, resolver, unwound);
+            delta = CctxDelta();
+        }
+    }
 }
 
 otf2::definition::mapping_table
@@ -824,30 +1050,65 @@ const otf2::definition::string& Trace::intern_syscall_str(int64_t syscall_nr)
 }
 const otf2::definition::source_code_location& Trace::intern_scl(const LineInfo& info)
 {
-    return registry_.emplace<otf2::definition::source_code_location>(ByLineInfo(info),
-                                                                     intern(info.file), info.line);
+    {
+        std::shared_lock<std::shared_mutex> lock(line_info_mutex_);
+        if (auto it = line_info_scls_.find(info); it != line_info_scls_.end())
+        {
+            return it->second;
+        }
+    }
+
+    std::lock_guard<std::recursive_mutex> guard(mutex_);
+    // Only ever inserted with mutex_ held, so no need for the shared lock here
+    if (auto it = line_info_scls_.find(info); it != line_info_scls_.end())
+    {
+        return it->second;
+    }
+
+    const auto& scl =
+        registry_.create<otf2::definition::source_code_location>(intern(info.file()), info.line());
+
+    std::lock_guard<std::shared_mutex> lock(line_info_mutex_);
+    return line_info_scls_.emplace(info, scl).first->second;
 }
 
 const otf2::definition::region& Trace::intern_region(const LineInfo& info)
 {
-    const auto& name_str = intern(info.function);
-    const auto& region = registry_.emplace<otf2::definition::region>(
-        ByLineInfo(info), name_str, name_str, name_str, otf2::common::role_type::function,
-        otf2::common::paradigm_type::sampling, otf2::common::flags_type::none, intern(info.file),
-        info.line, 0);
+    {
+        std::shared_lock<std::shared_mutex> lock(line_info_mutex_);
+        if (auto it = line_info_regions_.find(info); it != line_info_regions_.end())
+        {
+            return it->second;
+        }
+    }
+
+    std::lock_guard<std::recursive_mutex> guard(mutex_);
+    if (auto it = line_info_regions_.find(info); it != line_info_regions_.end())
+    {
+        return it->second;
+    }
 
-    if (registry_.has<otf2::definition::regions_group>(ByString(info.dso)))
+    const auto& name_str = intern(info.function());
+    const auto& region = registry_.create<otf2::definition::region>(
+        name_str, name_str, name_str, otf2::common::role_type::function,
+        otf2::common::paradigm_type::sampling, otf2::common::flags_type::none, intern(info.file()),
+        info.line(), 0);
+
+    if (registry_.has<otf2::definition::regions_group>(ByString(info.dso())))
     {
-        registry_.get<otf2::definition::regions_group>(ByString(info.dso)).add_member(region);
+        registry_.get<otf2::definition::regions_group>(ByString(info.dso())).add_member(region);
     }
     else
     {
-        registry_.emplace<otf2::definition::regions_group>(ByString(info.dso), intern(info.dso),
+        registry_.emplace<otf2::definition::regions_group>(ByString(info.dso()), intern(info.dso()),
                                                            otf2::common::paradigm_type::compiler,
                                                            otf2::common::group_flag_type::none);
     }
-    return region;
+
+    std::lock_guard<std::shared_mutex> lock(line_info_mutex_);
+    return line_info_regions_.emplace(info, region).first->second;
 }
+
 const otf2::definition::string& Trace::intern(const std::string& name)
 {
     std::lock_guard<std::recursive_mutex> guard(mutex_);
@@ -861,18 +1122,42 @@ ThreadCctxRefMap& Trace::create_cctx_refs()
 
     assert(!cctx_refs_finalized_);
 
-    return cctx_refs_.emplace_back();
+    auto& cctx = cctx_refs_.emplace_back();
+    if (config().dwarf_unwind)
+    {
+        cctx.spill = std::make_unique<StackSpill>(
+            std::filesystem::temp_directory_path() /
+            fmt::format("lo2s-stacks-{}-{}", getpid(), cctx_refs_.size()));
+    }
+    return cctx;
 }
 
-void Trace::merge_calling_contexts(const std::map<Process, ProcessInfo>& process_infos)
+void Trace::merge_calling_contexts(const ProcessMaps& process_maps)
 {
     for (auto& cctx : cctx_refs_)
     {
         assert(cctx.writer != nullptr);
+        // The writer is done, so its remaining tree is merged just like a handed off delta
+        cctx.pending.push_back(CctxDelta{ std::move(cctx.map), std::move(cctx.trie),
+                                          cctx.spill ? cctx.spill->flush() : 0 });
+    }
+
+    merge_pending_calling_contexts(process_maps);
+
+    for (auto& cctx : cctx_refs_)
+    {
         if (cctx.ref_count > 0)
         {
-            const auto& mapping = merge_calling_contexts(cctx.map, cctx.ref_count, process_infos);
-            (*cctx.writer) << mapping;
+#ifndef NDEBUG
+            assert(cctx.mappings.size() == cctx.ref_count);
+            for (auto id : cctx.mappings)
+            {
+                assert(id != -1u);
+            }
+#endif
+            (*cctx.writer) << otf2::definition::mapping_table(
+                otf2::definition::mapping_table::mapping_type_type::calling_context,
+                cctx.mappings);
         }
     }
     cctx_refs_.clear();